@@ -0,0 +1,56 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <rct/Serializer.h>
+#include <rct/String.h>
+#include <memory>
+
+namespace plast {
+
+// immutable, reference counted bytes for preprocessed data and object
+// code. copies share the data, so a job, its retries and the messages
+// carrying it all point at the same allocation
+class Buffer
+{
+public:
+    Buffer() {}
+    Buffer(String&& data)
+        : mData(data.isEmpty() ? std::shared_ptr<const String>() : std::make_shared<const String>(std::move(data)))
+    {
+    }
+    Buffer(const String& data)
+        : mData(data.isEmpty() ? std::shared_ptr<const String>() : std::make_shared<const String>(data))
+    {
+    }
+
+    bool isEmpty() const { return !mData; }
+    size_t size() const { return mData ? mData->size() : 0; }
+    const char* constData() const { return string().constData(); }
+    const String& string() const
+    {
+        static const String empty;
+        return mData ? *mData : empty;
+    }
+    void clear() { mData.reset(); }
+
+private:
+    std::shared_ptr<const String> mData;
+};
+
+}
+
+inline Serializer& operator<<(Serializer& serializer, const plast::Buffer& buffer)
+{
+    serializer << buffer.string();
+    return serializer;
+}
+
+inline Deserializer& operator>>(Deserializer& deserializer, plast::Buffer& buffer)
+{
+    String data;
+    deserializer >> data;
+    buffer = std::move(data);
+    return deserializer;
+}
+
+#endif
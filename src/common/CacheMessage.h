@@ -0,0 +1,60 @@
+#ifndef CACHEMESSAGE_H
+#define CACHEMESSAGE_H
+
+#include <Plast.h>
+#include <rct/Message.h>
+#include <rct/Sha256.h>
+#include <cstdint>
+
+class CacheMessage : public Message
+{
+public:
+    typedef std::shared_ptr<CacheMessage> SharedPtr;
+
+    enum { MessageId = plast::CacheMessageId };
+    enum Type { Get, Put, Found, NotFound };
+
+    CacheMessage() : Message(MessageId), mType(Get) {}
+    CacheMessage(Type type, const String& key, String&& data = String())
+        : Message(MessageId), mType(type), mKey(key), mData(std::move(data))
+    {
+        if (!mData.isEmpty())
+            mDigest = Sha256::hash(mData, Sha256::Hex);
+    }
+
+    Type type() const { return mType; }
+    String key() const { return mKey; }
+    String data() const { return mData; }
+
+    // the data is what the sender hashed, it says nothing about
+    // whether it belongs to the key
+    bool isIntact() const { return !mData.isEmpty() && Sha256::hash(mData, Sha256::Hex) == mDigest; }
+
+    virtual int encodedSize() const;
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    Type mType;
+    String mKey, mData, mDigest;
+};
+
+inline int CacheMessage::encodedSize() const
+{
+    return sizeof(uint8_t) + sizeof(uint32_t) + mKey.size() + sizeof(uint32_t) + mData.size()
+        + sizeof(uint32_t) + mDigest.size();
+}
+
+inline void CacheMessage::encode(Serializer& serializer) const
+{
+    serializer << static_cast<uint8_t>(mType) << mKey << mData << mDigest;
+}
+
+inline void CacheMessage::decode(Deserializer& deserializer)
+{
+    uint8_t type;
+    deserializer >> type >> mKey >> mData >> mDigest;
+    mType = static_cast<Type>(type);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef CACHERINGMESSAGE_H
+#define CACHERINGMESSAGE_H
+
+#include <Plast.h>
+#include <rct/List.h>
+#include <rct/Message.h>
+#include <cstdint>
+
+class CacheRingMessage : public Message
+{
+public:
+    typedef std::shared_ptr<CacheRingMessage> SharedPtr;
+
+    enum { MessageId = plast::CacheRingMessageId };
+
+    struct Member
+    {
+        String host;
+        uint16_t port;
+    };
+
+    CacheRingMessage() : Message(MessageId), mSelf(-1) {}
+    CacheRingMessage(const List<Member>& members, int32_t self)
+        : Message(MessageId), mMembers(members), mSelf(self)
+    {
+    }
+
+    List<Member> members() const { return mMembers; }
+    // index of the receiving daemon in members, -1 if not a member
+    int32_t self() const { return mSelf; }
+
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    List<Member> mMembers;
+    int32_t mSelf;
+};
+
+inline Serializer& operator<<(Serializer& serializer, const CacheRingMessage::Member& member)
+{
+    serializer << member.host << member.port;
+    return serializer;
+}
+
+inline Deserializer& operator>>(Deserializer& deserializer, CacheRingMessage::Member& member)
+{
+    deserializer >> member.host >> member.port;
+    return deserializer;
+}
+
+inline void CacheRingMessage::encode(Serializer& serializer) const
+{
+    serializer << mMembers << mSelf;
+}
+
+inline void CacheRingMessage::decode(Deserializer& deserializer)
+{
+    deserializer >> mMembers >> mSelf;
+}
+
+#endif
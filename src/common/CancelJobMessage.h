@@ -0,0 +1,43 @@
+#ifndef CANCELJOBMESSAGE_H
+#define CANCELJOBMESSAGE_H
+
+#include <Plast.h>
+#include <rct/Message.h>
+#include <cstdint>
+
+// the requester no longer wants the attempt with this id and serial
+class CancelJobMessage : public Message
+{
+public:
+    typedef std::shared_ptr<CancelJobMessage> SharedPtr;
+
+    enum { MessageId = plast::CancelJobMessageId };
+
+    CancelJobMessage() : Message(MessageId), mId(0), mSerial(0) {}
+    CancelJobMessage(uint64_t id, uint32_t serial)
+        : Message(MessageId), mId(id), mSerial(serial)
+    {
+    }
+
+    uint64_t id() const { return mId; }
+    uint32_t serial() const { return mSerial; }
+
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    uint64_t mId;
+    uint32_t mSerial;
+};
+
+inline void CancelJobMessage::encode(Serializer& serializer) const
+{
+    serializer << mId << mSerial;
+}
+
+inline void CancelJobMessage::decode(Deserializer& deserializer)
+{
+    deserializer >> mId >> mSerial;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef COMPILERSMESSAGE_H
+#define COMPILERSMESSAGE_H
+
+#include <Plast.h>
+#include <rct/List.h>
+#include <rct/Message.h>
+#include <cstdint>
+
+// the compilers a daemon can build with, sent to the scheduler on
+// connect and whenever they change
+class CompilersMessage : public Message
+{
+public:
+    typedef std::shared_ptr<CompilersMessage> SharedPtr;
+
+    enum { MessageId = plast::CompilersMessageId };
+
+    struct Compiler
+    {
+        plast::CompilerKey key;
+        // sha256 of the compiler binary, empty if unknown
+        String hash;
+    };
+
+    CompilersMessage() : Message(MessageId) {}
+    CompilersMessage(const List<Compiler>& compilers)
+        : Message(MessageId), mCompilers(compilers)
+    {
+    }
+
+    const List<Compiler>& compilers() const { return mCompilers; }
+
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    List<Compiler> mCompilers;
+};
+
+inline Serializer& operator<<(Serializer& serializer, const CompilersMessage::Compiler& compiler)
+{
+    serializer << static_cast<int32_t>(compiler.key.type) << compiler.key.major << compiler.key.target << compiler.hash;
+    return serializer;
+}
+
+inline Deserializer& operator>>(Deserializer& deserializer, CompilersMessage::Compiler& compiler)
+{
+    int32_t ctype;
+    deserializer >> ctype >> compiler.key.major >> compiler.key.target >> compiler.hash;
+    compiler.key.type = static_cast<plast::CompilerType>(ctype);
+    return deserializer;
+}
+
+inline void CompilersMessage::encode(Serializer& serializer) const
+{
+    serializer << mCompilers;
+}
+
+inline void CompilersMessage::decode(Deserializer& deserializer)
+{
+    deserializer >> mCompilers;
+}
+
+#endif
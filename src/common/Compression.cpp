@@ -0,0 +1,118 @@
+#include "Compression.h"
+#include <rct/Log.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <string.h>
+
+namespace plast {
+
+// compressed payloads start with the uncompressed size
+enum { HeaderSize = sizeof(uint32_t) };
+
+uint32_t supportedCompression()
+{
+    uint32_t ret = NoCompression;
+#ifdef HAVE_LZ4
+    ret |= LZ4Compression;
+#endif
+#ifdef HAVE_ZSTD
+    ret |= ZstdCompression;
+#endif
+    return ret;
+}
+
+const char* compressionName(Compression compression)
+{
+    switch (compression) {
+    case NoCompression: return "none";
+    case LZ4Compression: return "lz4";
+    case ZstdCompression: return "zstd";
+    }
+    return "";
+}
+
+String compress(const String& data, Compression compression, int level)
+{
+    return compress(data.constData(), data.size(), compression, level);
+}
+
+String compress(const char* data, size_t length, Compression compression, int level)
+{
+    if (!length || length > INT32_MAX)
+        return String();
+    String out;
+    const uint32_t size = length;
+    switch (compression) {
+    case NoCompression:
+        return String(data, length);
+    case LZ4Compression: {
+#ifdef HAVE_LZ4
+        out.resize(HeaderSize + LZ4_compressBound(size));
+        memcpy(out.data(), &size, HeaderSize);
+        const int w = LZ4_compress_default(data, out.data() + HeaderSize, size, out.size() - HeaderSize);
+        if (w <= 0)
+            return String();
+        out.resize(HeaderSize + w);
+#endif
+        break; }
+    case ZstdCompression: {
+#ifdef HAVE_ZSTD
+        out.resize(HeaderSize + ZSTD_compressBound(size));
+        memcpy(out.data(), &size, HeaderSize);
+        const size_t w = ZSTD_compress(out.data() + HeaderSize, out.size() - HeaderSize,
+                                       data, size, level);
+        if (ZSTD_isError(w))
+            return String();
+        out.resize(HeaderSize + w);
+#else
+        (void)level;
+#endif
+        break; }
+    }
+    return out;
+}
+
+bool uncompress(const String& data, Compression compression, String& out)
+{
+    if (compression == NoCompression) {
+        out = data;
+        return true;
+    }
+    uint32_t size;
+    if (data.size() < HeaderSize)
+        return false;
+    memcpy(&size, data.constData(), HeaderSize);
+    if (size > MaxUncompressedSize) {
+        error() << "Refusing to uncompress" << compressionName(compression) << "payload claiming" << size << "bytes";
+        out.clear();
+        return false;
+    }
+    out.resize(size);
+    const char* src = data.constData() + HeaderSize;
+    const int srcSize = data.size() - HeaderSize;
+    switch (compression) {
+    case NoCompression:
+        break;
+    case LZ4Compression:
+#ifdef HAVE_LZ4
+        if (LZ4_decompress_safe(src, out.data(), srcSize, size) == static_cast<int>(size))
+            return true;
+#endif
+        break;
+    case ZstdCompression:
+#ifdef HAVE_ZSTD
+        if (ZSTD_decompress(out.data(), size, src, srcSize) == size)
+            return true;
+#endif
+        break;
+    }
+    error() << "Unable to uncompress" << compressionName(compression) << "payload of" << data.size() << "bytes";
+    out.clear();
+    return false;
+}
+
+} // namespace plast
@@ -0,0 +1,34 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <rct/String.h>
+#include <cstdint>
+
+namespace plast {
+
+// payload encodings, also used as a bitmask of what a peer can decode
+enum Compression {
+    NoCompression = 0x0,
+    LZ4Compression = 0x1,
+    ZstdCompression = 0x2
+};
+
+enum {
+    // larger payloads are streamed in chunks, so a size header above
+    // this is garbage or a peer trying to make us allocate
+    MaxUncompressedSize = 64 * 1024 * 1024
+};
+
+// the encodings this build can do
+uint32_t supportedCompression();
+const char* compressionName(Compression compression);
+
+// returns an empty string on failure, level only applies to zstd
+String compress(const String& data, Compression compression, int level = 1);
+String compress(const char* data, size_t length, Compression compression, int level = 1);
+// fails for payloads claiming to be larger than MaxUncompressedSize
+bool uncompress(const String& data, Compression compression, String& out);
+
+} // namespace plast
+
+#endif
@@ -10,27 +10,39 @@ public:
     typedef std::shared_ptr<HandshakeMessage> SharedPtr;
 
     enum { MessageId = plast::HandshakeMessageId };
+    enum Flag { None = 0x0, HasCache = 0x1, HasChunkStore = 0x2 };
 
-    HandshakeMessage() : Message(MessageId), mPort(0) {}
-    HandshakeMessage(uint16_t port) : Message(MessageId), mPort(port) {}
+    HandshakeMessage() : Message(MessageId), mPort(0), mFlags(None), mCompression(0), mFeatures(0) {}
+    HandshakeMessage(uint16_t port, uint32_t flags = None, uint32_t compression = 0, uint32_t features = 0)
+        : Message(MessageId), mPort(port), mFlags(flags), mCompression(compression), mFeatures(features)
+    {
+    }
 
     uint16_t port() const { return mPort; }
+    uint32_t flags() const { return mFlags; }
+    // mask of plast::Compression the sender can decode
+    uint32_t compression() const { return mCompression; }
+    // mask of plast::WireFeature the sender can decode
+    uint32_t features() const { return mFeatures; }
 
     virtual void encode(Serializer& serializer) const;
     virtual void decode(Deserializer& deserializer);
 
 private:
     uint16_t mPort;
+    uint32_t mFlags;
+    uint32_t mCompression;
+    uint32_t mFeatures;
 };
 
 inline void HandshakeMessage::encode(Serializer& serializer) const
 {
-    serializer << mPort;
+    serializer << mPort << mFlags << mCompression << mFeatures;
 }
 
 inline void HandshakeMessage::decode(Deserializer& deserializer)
 {
-    deserializer >> mPort;
+    deserializer >> mPort >> mFlags >> mCompression >> mFeatures;
 }
 
 #endif
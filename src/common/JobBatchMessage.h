@@ -0,0 +1,69 @@
+#ifndef JOBBATCHMESSAGE_H
+#define JOBBATCHMESSAGE_H
+
+#include <JobMessage.h>
+#include <Plast.h>
+#include <rct/List.h>
+#include <rct/Message.h>
+#include <memory>
+#include <cstdint>
+
+// several small jobs for the same compiler in one message, handled
+// in order as if they had arrived one by one
+class JobBatchMessage : public Message
+{
+public:
+    typedef std::shared_ptr<JobBatchMessage> SharedPtr;
+
+    enum { MessageId = plast::JobBatchMessageId };
+
+    JobBatchMessage() : Message(MessageId) { }
+
+    const List<JobMessage::SharedPtr>& jobs() const { return mJobs; }
+    void append(const JobMessage::SharedPtr& job) { mJobs.append(job); }
+
+    void setWireFeatures(uint8_t features)
+    {
+        for (const JobMessage::SharedPtr& job : mJobs) {
+            job->setWireFeatures(features);
+        }
+    }
+
+    virtual int encodedSize() const;
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    List<JobMessage::SharedPtr> mJobs;
+};
+
+inline int JobBatchMessage::encodedSize() const
+{
+    int size = sizeof(uint32_t);
+    for (const JobMessage::SharedPtr& job : mJobs) {
+        size += job->encodedSize();
+    }
+    return size;
+}
+
+inline void JobBatchMessage::encode(Serializer& serializer) const
+{
+    serializer << static_cast<uint32_t>(mJobs.size());
+    for (const JobMessage::SharedPtr& job : mJobs) {
+        job->encode(serializer);
+    }
+}
+
+inline void JobBatchMessage::decode(Deserializer& deserializer)
+{
+    uint32_t count;
+    deserializer >> count;
+    mJobs.clear();
+    for (uint32_t i=0; i<count; ++i) {
+        JobMessage::SharedPtr job = std::make_shared<JobMessage>();
+        job->decode(deserializer);
+        mJobs.append(job);
+    }
+}
+
+#endif
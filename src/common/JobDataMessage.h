@@ -0,0 +1,102 @@
+#ifndef JOBDATAMESSAGE_H
+#define JOBDATAMESSAGE_H
+
+#include <Buffer.h>
+#include <Compression.h>
+#include <Plast.h>
+#include <WireFormat.h>
+#include <rct/Message.h>
+#include <cstdint>
+#include <assert.h>
+
+// one chunk of a streamed payload, preprocessed data going out to
+// the peer or object code coming back. id is always the job id on
+// the side that owns the job
+class JobDataMessage : public Message
+{
+public:
+    typedef std::shared_ptr<JobDataMessage> SharedPtr;
+
+    enum { MessageId = plast::JobDataMessageId };
+    enum Type { Payload, Object };
+
+    JobDataMessage()
+        : Message(MessageId), mType(Payload), mId(0), mSerial(0), mOffset(0), mLength(0),
+          mCompression(plast::NoCompression), mLast(false), mWire(0)
+    {
+    }
+    JobDataMessage(Type type, uint64_t id, uint32_t serial, String&& data,
+                   plast::Compression compression, bool last)
+        : Message(MessageId), mType(type), mId(id), mSerial(serial), mData(std::move(data)),
+          mOffset(0), mLength(mData.size()), mCompression(compression), mLast(last), mWire(0)
+    {
+    }
+    // an uncompressed chunk, written straight from the shared buffer
+    JobDataMessage(Type type, uint64_t id, uint32_t serial, const plast::Buffer& buffer,
+                   size_t offset, size_t length, bool last)
+        : Message(MessageId), mType(type), mId(id), mSerial(serial), mBuffer(buffer),
+          mOffset(offset), mLength(length), mCompression(plast::NoCompression), mLast(last), mWire(0)
+    {
+        assert(offset + length <= buffer.size());
+    }
+
+    Type type() const { return mType; }
+    uint64_t id() const { return mId; }
+    uint32_t serial() const { return mSerial; }
+    const String& data() const { return mData; }
+    plast::Compression compression() const { return mCompression; }
+    bool isLast() const { return mLast; }
+    void setWireFeatures(uint8_t features) { mWire = features; }
+
+    virtual int encodedSize() const;
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    Type mType;
+    uint64_t mId;
+    uint32_t mSerial;
+    String mData;
+    plast::Buffer mBuffer;
+    size_t mOffset, mLength;
+    plast::Compression mCompression;
+    bool mLast;
+    uint8_t mWire;
+};
+
+inline int JobDataMessage::encodedSize() const
+{
+    const bool compact = mWire & plast::CompactEncoding;
+    return sizeof(mWire) + sizeof(uint8_t) + (compact ? plast::varintSize(mId) : sizeof(mId))
+        + (compact ? plast::varintSize(mSerial) : sizeof(mSerial)) + sizeof(uint32_t) + mLength
+        + sizeof(uint8_t) + sizeof(mLast);
+}
+
+inline void JobDataMessage::encode(Serializer& serializer) const
+{
+    serializer << mWire << static_cast<uint8_t>(mType);
+    plast::writeNumber(serializer, mId, mWire);
+    plast::writeNumber(serializer, mSerial, mWire);
+    if (mBuffer.isEmpty()) {
+        serializer << mData;
+    } else {
+        // same layout as a String
+        serializer << static_cast<uint32_t>(mLength);
+        serializer.write(mBuffer.constData() + mOffset, mLength);
+    }
+    serializer << static_cast<uint8_t>(mCompression) << mLast;
+}
+
+inline void JobDataMessage::decode(Deserializer& deserializer)
+{
+    uint8_t type, compression;
+    deserializer >> mWire >> type;
+    plast::readNumber(deserializer, mId, mWire);
+    plast::readNumber(deserializer, mSerial, mWire);
+    deserializer >> mData >> compression >> mLast;
+    mLength = mData.size();
+    mType = static_cast<Type>(type);
+    mCompression = static_cast<plast::Compression>(compression);
+}
+
+#endif
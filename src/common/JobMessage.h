@@ -1,8 +1,12 @@
 #ifndef JOBMESSAGE_H
 #define JOBMESSAGE_H
 
+#include <Buffer.h>
+#include <Compression.h>
 #include <Plast.h>
+#include <WireFormat.h>
 #include <rct/List.h>
+#include <rct/Map.h>
 #include <rct/Message.h>
 #include <rct/Path.h>
 #include <rct/String.h>
@@ -15,29 +19,73 @@ public:
     typedef std::shared_ptr<JobMessage> SharedPtr;
 
     enum { MessageId = plast::JobMessageId };
+    enum Flag { None = 0x0, Streamed = 0x1, Chunked = 0x2, Pump = 0x4 };
 
     JobMessage()
-        : Message(MessageId), mId(0), mSerial(0), mCompilerType(plast::Unknown), mCompilerMajor(-1)
+        : Message(MessageId), mId(0), mCompression(plast::NoCompression), mFlags(None), mSerial(0), mWire(0)
     {
     }
-    JobMessage(const Path& path, const List<String>& args, uint64_t id = 0, const String& pre = String(),
+    JobMessage(const Path& path, const List<String>& args, uint64_t id = 0, const plast::Buffer& pre = plast::Buffer(),
                uint32_t serial = 0, const String& remoteName = String(), plast::CompilerType ctype = plast::Unknown,
-               int cmajor = 0, const String& ctarget = String())
+               int cmajor = 0, const String& ctarget = String(), const String& preHash = String(),
+               plast::Compression compression = plast::NoCompression, uint32_t flags = None)
         : Message(MessageId), mPath(path), mArgs(args), mId(id),
-          mPreprocessed(pre), mSerial(serial), mRemoteName(remoteName),
-          mCompilerType(ctype), mCompilerMajor(cmajor), mCompilerTarget(ctarget)
+          mPreprocessed(pre), mPreprocessedHash(preHash), mCompression(compression),
+          mFlags(flags), mSerial(serial), mRemoteName(remoteName),
+          mCompiler(ctype, cmajor, ctarget), mWire(0)
     {
     }
 
     Path path() const { return mPath; }
-    List<String> args() const { return mArgs; }
-    String preprocessed() const { return mPreprocessed; }
+    const List<String>& args() const { return mArgs; }
+    const String& preprocessed() const { return mPreprocessed.string(); }
+    const plast::Buffer& preprocessedBuffer() const { return mPreprocessed; }
+    // set without a payload when offering a job by hash
+    String preprocessedHash() const { return mPreprocessedHash; }
+    // how preprocessed() is encoded
+    plast::Compression compression() const { return mCompression; }
+    // preprocessed data follows in JobDataMessages
+    bool isStreamed() const { return mFlags & Streamed; }
+
+    // preprocessed() only holds the chunks the peer didn't have, a
+    // size of 0 refers to a chunk from its store
+    bool isChunked() const { return mFlags & Chunked; }
+    List<String> chunks() const { return mChunks; }
+    List<uint32_t> chunkSizes() const { return mChunkSizes; }
+    void setChunks(const List<String>& chunks, const List<uint32_t>& sizes)
+    {
+        mChunks = chunks;
+        mChunkSizes = sizes;
+        mFlags |= Chunked;
+    }
+
+    // pump mode, no preprocessed data. the peer preprocesses from the
+    // source and headers in files, their content is only included for
+    // hashes not sent on this connection before
+    bool isPump() const { return mFlags & Pump; }
+    List<String> files() const { return mFiles; }
+    List<String> fileHashes() const { return mFileHashes; }
+    Map<String, String> fileContents() const { return mFileContents; }
+    List<String> systemDirs() const { return mSystemDirs; }
+    void setPump(const List<String>& files, const List<String>& hashes,
+                 const Map<String, String>& contents, const List<String>& systemDirs)
+    {
+        mFiles = files;
+        mFileHashes = hashes;
+        mFileContents = contents;
+        mSystemDirs = systemDirs;
+        mFlags |= Pump;
+    }
     uint64_t id() const { return mId; }
     uint32_t serial() const { return mSerial; }
     String remoteName() const { return mRemoteName; }
-    plast::CompilerType compilerType() const { return mCompilerType; }
-    int compilerMajor() const { return mCompilerMajor; }
-    String compilerTarget() const { return mCompilerTarget; }
+    plast::CompilerType compilerType() const { return mCompiler.key().type; }
+    int compilerMajor() const { return mCompiler.key().major; }
+    String compilerTarget() const { return mCompiler.key().target; }
+    plast::WireCompilerKey& compiler() { return mCompiler; }
+
+    // plast::WireFeature mask to encode with, for the peer's features
+    void setWireFeatures(uint8_t features) { mWire = features; }
 
     virtual int encodedSize() const;
     virtual void encode(Serializer& serializer) const;
@@ -47,45 +95,81 @@ private:
     Path mPath;
     List<String> mArgs;
     uint64_t mId;
-    String mPreprocessed;
+    plast::Buffer mPreprocessed;
+    String mPreprocessedHash;
+    plast::Compression mCompression;
+    uint32_t mFlags;
     uint32_t mSerial;
     String mRemoteName;
-    plast::CompilerType mCompilerType;
-    int32_t mCompilerMajor;
-    String mCompilerTarget;
+    plast::WireCompilerKey mCompiler;
+    uint8_t mWire;
+    List<String> mChunks;
+    List<uint32_t> mChunkSizes;
+    List<String> mFiles, mFileHashes, mSystemDirs;
+    Map<String, String> mFileContents;
 };
 
 inline int JobMessage::encodedSize() const
 {
-    int size = 0;
+    int size = sizeof(mWire);
     auto addString = [&size](const String &str) {
         size += sizeof(uint32_t) + str.size();
     };
+    const bool compact = mWire & plast::CompactEncoding;
 
     addString(mPath);
     size += sizeof(uint32_t);
     for (const auto &arg : mArgs) {
         addString(arg);
     }
-    size += sizeof(mId);
-    addString(mPreprocessed);
-    size += sizeof(mSerial);
+    size += compact ? plast::varintSize(mId) : sizeof(mId);
+    size += sizeof(uint32_t) + mPreprocessed.size();
+    addString(mPreprocessedHash);
+    size += sizeof(uint8_t) + sizeof(mFlags);
+    size += compact ? plast::varintSize(mSerial) : sizeof(mSerial);
     addString(mRemoteName);
-    size += sizeof(int32_t) + sizeof(mCompilerMajor);
-    addString(mCompilerTarget);
+    size += mCompiler.encodedSize(mWire);
+    size += sizeof(uint32_t);
+    for (const auto &chunk : mChunks) {
+        addString(chunk);
+    }
+    size += sizeof(uint32_t) + mChunkSizes.size() * sizeof(uint32_t);
+    for (const List<String>* list : { &mFiles, &mFileHashes, &mSystemDirs }) {
+        size += sizeof(uint32_t);
+        for (const auto &str : *list) {
+            addString(str);
+        }
+    }
+    size += sizeof(uint32_t);
+    for (const auto &content : mFileContents) {
+        addString(content.first);
+        addString(content.second);
+    }
     return size;
 }
 
 inline void JobMessage::encode(Serializer& serializer) const
 {
-    serializer << mPath << mArgs << mId << mPreprocessed << mSerial << mRemoteName << static_cast<int32_t>(mCompilerType) << mCompilerMajor << mCompilerTarget;
+    serializer << mWire << mPath << mArgs;
+    plast::writeNumber(serializer, mId, mWire);
+    serializer << mPreprocessed << mPreprocessedHash << static_cast<uint8_t>(mCompression) << mFlags;
+    plast::writeNumber(serializer, mSerial, mWire);
+    serializer << mRemoteName;
+    mCompiler.encode(serializer, mWire);
+    serializer << mChunks << mChunkSizes << mFiles << mFileHashes << mSystemDirs << mFileContents;
 }
 
 inline void JobMessage::decode(Deserializer& deserializer)
 {
-    int32_t ctype;
-    deserializer >> mPath >> mArgs >> mId >> mPreprocessed >> mSerial >> mRemoteName >> ctype >> mCompilerMajor >> mCompilerTarget;
-    mCompilerType = static_cast<plast::CompilerType>(ctype);
+    uint8_t compression;
+    deserializer >> mWire >> mPath >> mArgs;
+    plast::readNumber(deserializer, mId, mWire);
+    deserializer >> mPreprocessed >> mPreprocessedHash >> compression >> mFlags;
+    plast::readNumber(deserializer, mSerial, mWire);
+    deserializer >> mRemoteName;
+    mCompiler.decode(deserializer, mWire);
+    deserializer >> mChunks >> mChunkSizes >> mFiles >> mFileHashes >> mSystemDirs >> mFileContents;
+    mCompression = static_cast<plast::Compression>(compression);
 }
 
 #endif
@@ -0,0 +1,71 @@
+#ifndef JOBRESPONSEBATCHMESSAGE_H
+#define JOBRESPONSEBATCHMESSAGE_H
+
+#include <JobResponseMessage.h>
+#include <Plast.h>
+#include <rct/List.h>
+#include <rct/Message.h>
+#include <memory>
+#include <cstdint>
+
+// responses for several jobs, in the order they were produced
+class JobResponseBatchMessage : public Message
+{
+public:
+    typedef std::shared_ptr<JobResponseBatchMessage> SharedPtr;
+
+    enum { MessageId = plast::JobResponseBatchMessageId };
+
+    JobResponseBatchMessage() : Message(MessageId) { }
+    JobResponseBatchMessage(const List<JobResponseMessage::SharedPtr>& responses)
+        : Message(MessageId), mResponses(responses)
+    {
+    }
+
+    const List<JobResponseMessage::SharedPtr>& responses() const { return mResponses; }
+
+    void setWireFeatures(uint8_t features)
+    {
+        for (const JobResponseMessage::SharedPtr& response : mResponses) {
+            response->setWireFeatures(features);
+        }
+    }
+
+    virtual int encodedSize() const;
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    List<JobResponseMessage::SharedPtr> mResponses;
+};
+
+inline int JobResponseBatchMessage::encodedSize() const
+{
+    int size = sizeof(uint32_t);
+    for (const JobResponseMessage::SharedPtr& response : mResponses) {
+        size += response->encodedSize();
+    }
+    return size;
+}
+
+inline void JobResponseBatchMessage::encode(Serializer& serializer) const
+{
+    serializer << static_cast<uint32_t>(mResponses.size());
+    for (const JobResponseMessage::SharedPtr& response : mResponses) {
+        response->encode(serializer);
+    }
+}
+
+inline void JobResponseBatchMessage::decode(Deserializer& deserializer)
+{
+    uint32_t count;
+    deserializer >> count;
+    mResponses.clear();
+    for (uint32_t i=0; i<count; ++i) {
+        JobResponseMessage::SharedPtr response = std::make_shared<JobResponseMessage>();
+        response->decode(deserializer);
+        mResponses.append(response);
+    }
+}
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef JOBRESPONSEMESSAGE_H
 #define JOBRESPONSEMESSAGE_H
 
+#include <Buffer.h>
+#include <Compression.h>
 #include <Plast.h>
+#include <WireFormat.h>
 #include <rct/Message.h>
 #include <cstdint>
 
@@ -13,17 +16,29 @@ public:
     enum { MessageId = plast::JobResponseMessageId };
     enum Mode { Stdout, Stderr, Compiled, Error };
 
-    JobResponseMessage() : Message(MessageId), mMode(Stdout), mId(0), mSerial(0) {}
-    JobResponseMessage(Mode mode, int exitCode, uint64_t id, uint32_t serial, String &&data = String())
-        : Message(MessageId), mMode(mode), mExitCode(exitCode), mId(id), mSerial(serial), mData(std::move(data))
+    JobResponseMessage() : Message(MessageId), mMode(Stdout), mId(0), mSerial(0), mCompression(plast::NoCompression), mWire(0) {}
+    JobResponseMessage(Mode mode, int exitCode, uint64_t id, uint32_t serial, String &&data = String(),
+                       plast::Compression compression = plast::NoCompression)
+        : Message(MessageId), mMode(mode), mExitCode(exitCode), mId(id), mSerial(serial),
+          mData(std::move(data)), mCompression(compression), mWire(0)
+    {
+    }
+    JobResponseMessage(Mode mode, int exitCode, uint64_t id, uint32_t serial, const plast::Buffer& data,
+                       plast::Compression compression = plast::NoCompression)
+        : Message(MessageId), mMode(mode), mExitCode(exitCode), mId(id), mSerial(serial),
+          mData(data), mCompression(compression), mWire(0)
     {
     }
 
     Mode mode() const { return mMode; }
     uint64_t id() const { return mId; }
-    String data() const { return mData; }
+    const String& data() const { return mData.string(); }
+    const plast::Buffer& buffer() const { return mData; }
     uint32_t serial() const { return mSerial; }
     int exitCode() const { return mExitCode; }
+    // how data() is encoded
+    plast::Compression compression() const { return mCompression; }
+    void setWireFeatures(uint8_t features) { mWire = features; }
 
     virtual int encodedSize() const;
     virtual void encode(Serializer& serializer) const;
@@ -34,24 +49,52 @@ private:
     int mExitCode;
     uint64_t mId;
     uint32_t mSerial;
-    String mData;
+    plast::Buffer mData;
+    plast::Compression mCompression;
+    uint8_t mWire;
 };
 
 inline int JobResponseMessage::encodedSize() const
 {
-    return sizeof(int32_t) + sizeof(mExitCode) + sizeof(mId) + sizeof(mSerial) + sizeof(uint32_t) + mData.size();
+    if (mWire & plast::CompactEncoding) {
+        return sizeof(mWire) + sizeof(uint8_t) + plast::varintSize(static_cast<uint32_t>(mExitCode))
+            + plast::varintSize(mId) + plast::varintSize(mSerial) + sizeof(uint32_t) + mData.size() + sizeof(uint8_t);
+    }
+    return sizeof(mWire) + sizeof(int32_t) + sizeof(mExitCode) + sizeof(mId) + sizeof(mSerial) + sizeof(uint32_t) + mData.size() + sizeof(uint8_t);
 }
 
 inline void JobResponseMessage::encode(Serializer& serializer) const
 {
-    serializer << static_cast<uint32_t>(mMode) << mExitCode << mId << mSerial << mData;
+    serializer << mWire;
+    if (mWire & plast::CompactEncoding) {
+        serializer << static_cast<uint8_t>(mMode);
+        plast::writeVarint(serializer, static_cast<uint32_t>(mExitCode));
+        plast::writeVarint(serializer, mId);
+        plast::writeVarint(serializer, mSerial);
+    } else {
+        serializer << static_cast<uint32_t>(mMode) << mExitCode << mId << mSerial;
+    }
+    serializer << mData << static_cast<uint8_t>(mCompression);
 }
 
 inline void JobResponseMessage::decode(Deserializer& deserializer)
 {
     uint32_t mode;
-    deserializer >> mode >> mExitCode >> mId >> mSerial >> mData;
+    uint8_t compression;
+    deserializer >> mWire;
+    if (mWire & plast::CompactEncoding) {
+        uint8_t m;
+        deserializer >> m;
+        mode = m;
+        mExitCode = static_cast<int>(static_cast<uint32_t>(plast::readVarint(deserializer)));
+        mId = plast::readVarint(deserializer);
+        mSerial = static_cast<uint32_t>(plast::readVarint(deserializer));
+    } else {
+        deserializer >> mode >> mExitCode >> mId >> mSerial;
+    }
+    deserializer >> mData >> compression;
     mMode = static_cast<Mode>(mode);
+    mCompression = static_cast<plast::Compression>(compression);
 }
 
 #endif
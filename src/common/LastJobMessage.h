@@ -2,6 +2,7 @@
 #define LASTJOBMESSAGE_H
 
 #include <Plast.h>
+#include <WireFormat.h>
 #include <rct/Message.h>
 
 class LastJobMessage : public Message
@@ -11,38 +12,46 @@ public:
 
     enum { MessageId = plast::LastJobMessageId };
 
-    LastJobMessage() : Message(MessageId), mCompilerType(plast::Unknown), mCompilerMajor(-1), mCount(0), mHasMore(false) {}
+    LastJobMessage() : Message(MessageId), mCount(0), mHasMore(false), mWire(0) {}
     LastJobMessage(plast::CompilerType ctype, int32_t cmajor, const String& ctarget, int32_t count, bool hasMore)
-        : Message(MessageId), mCompilerType(ctype), mCompilerMajor(cmajor), mCompilerTarget(ctarget), mCount(count), mHasMore(hasMore)
+        : Message(MessageId), mCompiler(ctype, cmajor, ctarget), mCount(count), mHasMore(hasMore), mWire(0)
     {
     }
 
-    plast::CompilerType compilerType() const { return mCompilerType; }
-    int32_t compilerMajor() const { return mCompilerMajor; }
-    String compilerTarget() const { return mCompilerTarget; }
+    plast::CompilerType compilerType() const { return mCompiler.key().type; }
+    int32_t compilerMajor() const { return mCompiler.key().major; }
+    String compilerTarget() const { return mCompiler.key().target; }
+    plast::WireCompilerKey& compiler() { return mCompiler; }
     int32_t count() const { return mCount; }
     bool hasMore() const { return mHasMore; }
+    void setWireFeatures(uint8_t features) { mWire = features; }
 
     virtual void encode(Serializer& serializer) const;
     virtual void decode(Deserializer& deserializer);
 
 private:
-    plast::CompilerType mCompilerType;
-    int32_t mCompilerMajor;
-    String mCompilerTarget;
+    plast::WireCompilerKey mCompiler;
     int32_t mCount, mHasMore;
+    uint8_t mWire;
 };
 
 inline void LastJobMessage::encode(Serializer& serializer) const
 {
-    serializer << static_cast<int32_t>(mCompilerType) << mCompilerMajor << mCompilerTarget << mCount << mHasMore;
+    serializer << mWire;
+    mCompiler.encode(serializer, mWire);
+    plast::writeNumber(serializer, static_cast<uint32_t>(mCount), mWire);
+    plast::writeNumber(serializer, static_cast<uint32_t>(mHasMore), mWire);
 }
 
 inline void LastJobMessage::decode(Deserializer& deserializer)
 {
-    int32_t ctype;
-    deserializer >> ctype >> mCompilerMajor >> mCompilerTarget >> mCount >> mHasMore;
-    mCompilerType = static_cast<plast::CompilerType>(ctype);
+    uint32_t count, hasMore;
+    deserializer >> mWire;
+    mCompiler.decode(deserializer, mWire);
+    plast::readNumber(deserializer, count, mWire);
+    plast::readNumber(deserializer, hasMore, mWire);
+    mCount = static_cast<int32_t>(count);
+    mHasMore = static_cast<int32_t>(hasMore);
 }
 
 #endif
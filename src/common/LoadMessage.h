@@ -0,0 +1,108 @@
+#ifndef LOADMESSAGE_H
+#define LOADMESSAGE_H
+
+#include <Plast.h>
+#include <WireFormat.h>
+#include <rct/Message.h>
+
+// how busy a daemon is, sent to the scheduler. only the fields that
+// changed since the last one are sent, with all of them going out
+// every so often whether they changed or not
+class LoadMessage : public Message
+{
+public:
+    typedef std::shared_ptr<LoadMessage> SharedPtr;
+
+    enum { MessageId = plast::LoadMessageId };
+
+    enum Field {
+        Slots = 0x1,
+        Running = 0x2,
+        Pending = 0x4,
+        Remote = 0x8,
+        LoadAverage = 0x10,
+        Memory = 0x20,
+        AllFields = 0x3f
+    };
+
+    struct Load
+    {
+        Load()
+            : slots(0), running(0), pending(0), remote(0), loadAverage(0), memory(0)
+        {
+        }
+
+        // compile slots neither busy nor already asked for
+        uint32_t slots;
+        // compiles running, and jobs waiting for a slot or a peer
+        uint32_t running, pending;
+        // jobs we're building for peers
+        uint32_t remote;
+        // one minute load average in hundredths
+        uint32_t loadAverage;
+        // percentage of memory in use, 0 if unknown
+        uint32_t memory;
+    };
+
+    LoadMessage() : Message(MessageId), mFields(0) {}
+    LoadMessage(const Load& load)
+        : Message(MessageId), mFields(AllFields), mLoad(load)
+    {
+    }
+    // what changed since previous
+    LoadMessage(const Load& load, const Load& previous)
+        : Message(MessageId), mFields(0), mLoad(load)
+    {
+        for (int i=0; i<FieldCount; ++i) {
+            if (load.*field(i) != previous.*field(i))
+                mFields |= (1 << i);
+        }
+    }
+
+    uint8_t fields() const { return mFields; }
+    // update load with the fields this carries
+    void apply(Load& load) const
+    {
+        for (int i=0; i<FieldCount; ++i) {
+            if (mFields & (1 << i))
+                load.*field(i) = mLoad.*field(i);
+        }
+    }
+
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    enum { FieldCount = 6 };
+    // in Field order
+    static uint32_t Load::* field(int idx)
+    {
+        static uint32_t Load::* const fields[FieldCount] = {
+            &Load::slots, &Load::running, &Load::pending, &Load::remote, &Load::loadAverage, &Load::memory
+        };
+        return fields[idx];
+    }
+
+    uint8_t mFields;
+    Load mLoad;
+};
+
+inline void LoadMessage::encode(Serializer& serializer) const
+{
+    serializer << mFields;
+    for (int i=0; i<FieldCount; ++i) {
+        if (mFields & (1 << i))
+            plast::writeVarint(serializer, mLoad.*field(i));
+    }
+}
+
+inline void LoadMessage::decode(Deserializer& deserializer)
+{
+    deserializer >> mFields;
+    for (int i=0; i<FieldCount; ++i) {
+        if (mFields & (1 << i))
+            mLoad.*field(i) = static_cast<uint32_t>(plast::readVarint(deserializer));
+    }
+}
+
+#endif
@@ -12,6 +12,16 @@ void init()
     Message::registerMessage<PeerMessage>();
     Message::registerMessage<BuildingMessage>();
     Message::registerMessage<LastJobMessage>();
+    Message::registerMessage<RequestPayloadMessage>();
+    Message::registerMessage<CacheMessage>();
+    Message::registerMessage<CacheRingMessage>();
+    Message::registerMessage<JobDataMessage>();
+    Message::registerMessage<JobBatchMessage>();
+    Message::registerMessage<JobResponseBatchMessage>();
+    Message::registerMessage<CancelJobMessage>();
+    Message::registerMessage<LoadMessage>();
+    Message::registerMessage<CompilersMessage>();
+    Message::registerMessage<StatsMessage>();
 }
 
 } // namespace messages
@@ -9,6 +9,16 @@
 #include <PeerMessage.h>
 #include <BuildingMessage.h>
 #include <LastJobMessage.h>
+#include <RequestPayloadMessage.h>
+#include <CacheMessage.h>
+#include <CacheRingMessage.h>
+#include <JobDataMessage.h>
+#include <JobBatchMessage.h>
+#include <JobResponseBatchMessage.h>
+#include <CancelJobMessage.h>
+#include <LoadMessage.h>
+#include <CompilersMessage.h>
+#include <StatsMessage.h>
 
 namespace messages {
 void init();
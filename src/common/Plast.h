@@ -42,8 +42,9 @@ enum {
     DefaultRescheduleCheck = 2500,
     DefaultOvercommit = 4,
     DefaultMaxPreprocessPending = 100,
+    DefaultCacheSize = 5120,
 
-    ConnectionVersion = 1
+    ConnectionVersion = 9
 };
 const String DefaultServerHost = "127.0.0.1";
 const String DefaultCacheDirectory = PLAST_DATA_PREFIX "/var/cache/plast/";
@@ -57,6 +58,16 @@ enum {
     JobResponseMessageId,
     PeerMessageId,
     BuildingMessageId,
+    RequestPayloadMessageId,
+    CacheMessageId,
+    CacheRingMessageId,
+    JobDataMessageId,
+    JobBatchMessageId,
+    JobResponseBatchMessageId,
+    CancelJobMessageId,
+    LoadMessageId,
+    CompilersMessageId,
+    StatsMessageId,
 };
 
 } // namespace plast
@@ -2,6 +2,7 @@
 #define REQUESTJOBSMESSAGE_H
 
 #include <Plast.h>
+#include <WireFormat.h>
 #include <rct/Message.h>
 
 class RequestJobsMessage : public Message
@@ -11,36 +12,42 @@ public:
 
     enum { MessageId = plast::RequestJobsMessageId };
 
-    RequestJobsMessage() : Message(MessageId), mCompilerType(plast::Unknown), mCompilerMajor(-1), mCount(0) {}
+    RequestJobsMessage() : Message(MessageId), mCount(0), mWire(0) {}
     RequestJobsMessage(plast::CompilerType ctype, int32_t cmajor, const String& ctarget, int32_t count)
-        : Message(MessageId), mCompilerType(ctype), mCompilerTarget(ctarget), mCompilerMajor(cmajor), mCount(count)
+        : Message(MessageId), mCompiler(ctype, cmajor, ctarget), mCount(count), mWire(0)
     {
     }
 
-    plast::CompilerType compilerType() const { return mCompilerType; }
-    int32_t compilerMajor() const { return mCompilerMajor; }
-    String compilerTarget() const { return mCompilerTarget; }
+    plast::CompilerType compilerType() const { return mCompiler.key().type; }
+    int32_t compilerMajor() const { return mCompiler.key().major; }
+    String compilerTarget() const { return mCompiler.key().target; }
+    plast::WireCompilerKey& compiler() { return mCompiler; }
     int32_t count() const { return mCount; }
+    void setWireFeatures(uint8_t features) { mWire = features; }
 
     virtual void encode(Serializer& serializer) const;
     virtual void decode(Deserializer& deserializer);
 
 private:
-    plast::CompilerType mCompilerType;
-    String mCompilerTarget;
-    int32_t mCompilerMajor, mCount;
+    plast::WireCompilerKey mCompiler;
+    int32_t mCount;
+    uint8_t mWire;
 };
 
 inline void RequestJobsMessage::encode(Serializer& serializer) const
 {
-    serializer << mCount << mCompilerMajor << mCompilerTarget << static_cast<int32_t>(mCompilerType);
+    serializer << mWire;
+    plast::writeNumber(serializer, static_cast<uint32_t>(mCount), mWire);
+    mCompiler.encode(serializer, mWire);
 }
 
 inline void RequestJobsMessage::decode(Deserializer& deserializer)
 {
-    int32_t ctype;
-    deserializer >> mCount >> mCompilerMajor >> mCompilerTarget >> ctype;
-    mCompilerType = static_cast<plast::CompilerType>(ctype);
+    uint32_t count;
+    deserializer >> mWire;
+    plast::readNumber(deserializer, count, mWire);
+    mCount = static_cast<int32_t>(count);
+    mCompiler.decode(deserializer, mWire);
 }
 
 #endif
@@ -0,0 +1,42 @@
+#ifndef REQUESTPAYLOADMESSAGE_H
+#define REQUESTPAYLOADMESSAGE_H
+
+#include <Plast.h>
+#include <rct/Message.h>
+#include <cstdint>
+
+class RequestPayloadMessage : public Message
+{
+public:
+    typedef std::shared_ptr<RequestPayloadMessage> SharedPtr;
+
+    enum { MessageId = plast::RequestPayloadMessageId };
+
+    RequestPayloadMessage() : Message(MessageId), mId(0), mSerial(0) {}
+    RequestPayloadMessage(uint64_t id, uint32_t serial)
+        : Message(MessageId), mId(id), mSerial(serial)
+    {
+    }
+
+    uint64_t id() const { return mId; }
+    uint32_t serial() const { return mSerial; }
+
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    uint64_t mId;
+    uint32_t mSerial;
+};
+
+inline void RequestPayloadMessage::encode(Serializer& serializer) const
+{
+    serializer << mId << mSerial;
+}
+
+inline void RequestPayloadMessage::decode(Deserializer& deserializer)
+{
+    deserializer >> mId >> mSerial;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef STATSMESSAGE_H
+#define STATSMESSAGE_H
+
+#include <Plast.h>
+#include <rct/Map.h>
+#include <rct/Message.h>
+#include <cstdint>
+
+// running totals a daemon keeps, by name, sent to the scheduler for
+// the dashboard every so often when they changed
+class StatsMessage : public Message
+{
+public:
+    typedef std::shared_ptr<StatsMessage> SharedPtr;
+
+    enum { MessageId = plast::StatsMessageId };
+
+    StatsMessage() : Message(MessageId) {}
+    StatsMessage(const Map<String, uint64_t>& counters)
+        : Message(MessageId), mCounters(counters)
+    {
+    }
+
+    const Map<String, uint64_t>& counters() const { return mCounters; }
+
+    virtual void encode(Serializer& serializer) const;
+    virtual void decode(Deserializer& deserializer);
+
+private:
+    Map<String, uint64_t> mCounters;
+};
+
+inline void StatsMessage::encode(Serializer& serializer) const
+{
+    serializer << mCounters;
+}
+
+inline void StatsMessage::decode(Deserializer& deserializer)
+{
+    deserializer >> mCounters;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef WIREFORMAT_H
+#define WIREFORMAT_H
+
+#include <Plast.h>
+#include <rct/Serializer.h>
+#include <rct/String.h>
+#include <cstdint>
+
+namespace plast {
+
+// optional encodings and messages, announced in
+// HandshakeMessage::features(). a sender only uses what the peer
+// announced, so new ones can be added without every daemon in the farm
+// upgrading at once. messages that support them start with a byte of
+// the features they were encoded with
+enum WireFeature {
+    CompactEncoding = 0x1,
+    // compiler keys are sent once per connection and referred to by id
+    InternedCompilers = 0x2,
+    // RequestJobsMessage grants credit that adds up and the peer pushes
+    // jobs against it, LastJobMessage hands back credit it can't use
+    CreditFlow = 0x4,
+    // small jobs and their responses go several to a message
+    BatchedJobs = 0x8,
+    // CancelJobMessage is understood
+    JobCancel = 0x10
+};
+enum { WireFeatures = CompactEncoding | InternedCompilers | CreditFlow | BatchedJobs | JobCancel };
+
+inline void writeVarint(Serializer& serializer, uint64_t value)
+{
+    while (value >= 0x80) {
+        serializer << static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    serializer << static_cast<uint8_t>(value);
+}
+
+inline uint64_t readVarint(Deserializer& deserializer)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        deserializer >> byte;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+inline int varintSize(uint64_t value)
+{
+    int size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+// an id or serial, fixed size unless compact encoding is in use
+template <typename T>
+inline void writeNumber(Serializer& serializer, T value, uint8_t features)
+{
+    if (features & CompactEncoding) {
+        writeVarint(serializer, value);
+    } else {
+        serializer << value;
+    }
+}
+
+template <typename T>
+inline void readNumber(Deserializer& deserializer, T& value, uint8_t features)
+{
+    if (features & CompactEncoding) {
+        value = static_cast<T>(readVarint(deserializer));
+    } else {
+        deserializer >> value;
+    }
+}
+
+// the compiler key of a message. with InternedCompilers the key is
+// sent along with its id the first time only, the receiver fills it
+// in from its table for the connection after that
+class WireCompilerKey
+{
+public:
+    WireCompilerKey()
+        : mId(0), mDefined(true)
+    {
+        mKey.type = Unknown;
+        mKey.major = -1;
+    }
+    WireCompilerKey(CompilerType type, int32_t major, const String& target)
+        : mId(0), mDefined(true)
+    {
+        mKey.type = type;
+        mKey.major = major;
+        mKey.target = target;
+    }
+
+    const CompilerKey& key() const { return mKey; }
+
+    // sender
+    void intern(uint32_t id, bool define) { mId = id; mDefined = define; }
+
+    // receiver, id() is 0 unless interned. if it isn't defined the
+    // key has to come from an earlier message on the same connection
+    uint32_t id() const { return mId; }
+    bool isDefined() const { return mDefined; }
+    void resolve(const CompilerKey& key) { mKey = key; mDefined = true; }
+
+    void encode(Serializer& serializer, uint8_t features) const
+    {
+        if (features & InternedCompilers) {
+            writeVarint(serializer, mId);
+            serializer << static_cast<uint8_t>(mDefined);
+            if (!mDefined)
+                return;
+        }
+        serializer << static_cast<int32_t>(mKey.type) << mKey.major << mKey.target;
+    }
+
+    void decode(Deserializer& deserializer, uint8_t features)
+    {
+        mId = 0;
+        mDefined = true;
+        if (features & InternedCompilers) {
+            mId = static_cast<uint32_t>(readVarint(deserializer));
+            uint8_t defined;
+            deserializer >> defined;
+            mDefined = defined;
+            if (!mDefined)
+                return;
+        }
+        int32_t type;
+        deserializer >> type >> mKey.major >> mKey.target;
+        mKey.type = static_cast<CompilerType>(type);
+    }
+
+    int encodedSize(uint8_t features) const
+    {
+        int size = 0;
+        if (features & InternedCompilers) {
+            size += varintSize(mId) + sizeof(uint8_t);
+            if (!mDefined)
+                return size;
+        }
+        return size + sizeof(int32_t) + sizeof(int32_t) + sizeof(uint32_t) + mKey.target.size();
+    }
+
+private:
+    uint32_t mId;
+    bool mDefined;
+    CompilerKey mKey;
+};
+
+}
+
+#endif
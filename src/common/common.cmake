@@ -1,4 +1,5 @@
 set(MESSAGES_SOURCES
+  ${CMAKE_CURRENT_LIST_DIR}/Compression.cpp
   ${CMAKE_CURRENT_LIST_DIR}/HttpServer.cpp
   ${CMAKE_CURRENT_LIST_DIR}/Messages.cpp
   ${CMAKE_CURRENT_LIST_DIR}/Plast.cpp
@@ -6,6 +7,26 @@ set(MESSAGES_SOURCES
 
 add_library(common ${MESSAGES_SOURCES})
 
+find_path(LZ4_INCLUDE_DIR lz4.h)
+find_library(LZ4_LIBRARY lz4)
+if (LZ4_INCLUDE_DIR AND LZ4_LIBRARY)
+  add_definitions(-DHAVE_LZ4)
+  include_directories(${LZ4_INCLUDE_DIR})
+  target_link_libraries(common ${LZ4_LIBRARY})
+else()
+  message(STATUS "lz4 not found, building without lz4 compression")
+endif()
+
+find_path(ZSTD_INCLUDE_DIR zstd.h)
+find_library(ZSTD_LIBRARY zstd)
+if (ZSTD_INCLUDE_DIR AND ZSTD_LIBRARY)
+  add_definitions(-DHAVE_ZSTD)
+  include_directories(${ZSTD_INCLUDE_DIR})
+  target_link_libraries(common ${ZSTD_LIBRARY})
+else()
+  message(STATUS "zstd not found, building without zstd compression")
+endif()
+
 if (APPLE)
   find_library(SECURITY_LIBRARY Security)
   target_link_libraries(common ${SECURITY_LIBRARY})
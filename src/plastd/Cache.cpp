@@ -0,0 +1,383 @@
+#include "Cache.h"
+#include <rct/Log.h>
+#include <rct/Serializer.h>
+#include <rct/Sha256.h>
+#include <algorithm>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+Cache::Cache()
+    : mMaxSize(0), mSize(0)
+{
+}
+
+Cache::~Cache()
+{
+}
+
+bool Cache::init(const Path& directory, int64_t maxSize)
+{
+    if (maxSize <= 0)
+        return false;
+    if (!directory.mkdir(Path::Recursive) && !directory.isDir()) {
+        error() << "Unable to create cache directory" << directory << "cache disabled";
+        return false;
+    }
+    mDirectory = directory.ensureTrailingSlash();
+    mMaxSize = maxSize;
+
+    // temp files left behind by an interrupted insert
+    for (const Path& file : mDirectory.files(Path::File)) {
+        Path::rm(file);
+    }
+
+    // pick up entries from earlier runs, least recently used first
+    List<std::pair<uint64_t, Path> > files;
+    for (const Path& dir : mDirectory.files(Path::Directory)) {
+        for (const Path& file : dir.files(Path::File)) {
+            files.append(std::make_pair(file.lastModifiedMs(), file));
+        }
+    }
+    std::sort(files.begin(), files.end());
+    for (const auto& file : files) {
+        add(file.second.fileName(), file.second.fileSize());
+    }
+    evict();
+
+    error() << "cache" << mDirectory << "has" << mEntries.size() << "entries," << mSize << "of" << mMaxSize << "bytes";
+    return true;
+}
+
+static inline void hashCompiler(Sha256& sha, const CompilerVersion::SharedPtr& version)
+{
+    assert(version);
+    auto add = [&sha](const String& str) {
+        sha.update(str);
+        sha.update(String("\0", 1));
+    };
+    add(String::number(static_cast<int>(version->compiler())));
+    add(version->versionString());
+    add(version->target());
+    for (const String& arg : version->extraArgs()) {
+        add(arg);
+    }
+}
+
+static inline String hashArgs(Sha256& sha, const String& salt, const String& hash,
+                              const List<String>& args, const Path& cwd)
+{
+    auto add = [&sha](const String& str) {
+        sha.update(str);
+        sha.update(String("\0", 1));
+    };
+    add(salt);
+    add(hash);
+    for (const String& arg : args) {
+        add(arg);
+    }
+    add(cwd);
+    return sha.hash(Sha256::Hex);
+}
+
+String Cache::objectKey(const String& preprocessedHash, const CompilerVersion::SharedPtr& version,
+                        const List<String>& args, const Path& cwd)
+{
+    Sha256 sha;
+    hashCompiler(sha, version);
+    return hashArgs(sha, "object", preprocessedHash, args, cwd);
+}
+
+String Cache::directKey(const Path& source, const String& sourceHash, const CompilerVersion::SharedPtr& version,
+                        const List<String>& args, const Path& cwd)
+{
+    // the manifest names quoted includes as they were found next to
+    // this source, an identical file elsewhere finds different ones
+    Sha256 sha;
+    hashCompiler(sha, version);
+    sha.update(source);
+    sha.update(String("\0", 1));
+    return hashArgs(sha, "manifest", sourceHash, args, cwd);
+}
+
+enum { MaxFileHashes = 32768 };
+
+String Cache::hashFile(const Path& path)
+{
+    struct stat st;
+    if (stat(path.constData(), &st) == -1 || !S_ISREG(st.st_mode)) {
+        mFileHashes.erase(path);
+        return String();
+    }
+#ifdef OS_Darwin
+    const uint64_t modified = st.st_mtimespec.tv_sec * 1000000000ull + st.st_mtimespec.tv_nsec;
+#else
+    const uint64_t modified = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+#endif
+    auto it = mFileHashes.find(path);
+    if (it != mFileHashes.end()) {
+        const FileHash& cached = it->second;
+        if (cached.inode == static_cast<uint64_t>(st.st_ino)
+            && cached.size == static_cast<uint64_t>(st.st_size)
+            && cached.modified == modified) {
+            return cached.hash;
+        }
+    } else if (mFileHashes.size() >= MaxFileHashes) {
+        mFileHashes.clear();
+    }
+    FileHash& entry = mFileHashes[path];
+    entry.inode = st.st_ino;
+    entry.size = st.st_size;
+    entry.modified = modified;
+    entry.hash = Sha256::hash(path.readAll(), Sha256::Hex);
+    return entry.hash;
+}
+
+Path Cache::path(const String& key) const
+{
+    return mDirectory + key.left(2) + '/' + key;
+}
+
+bool Cache::read(const String& key, String& data)
+{
+    if (!isEnabled())
+        return false;
+    auto it = mEntries.find(key);
+    if (it == mEntries.end())
+        return false;
+    const Path file = path(key);
+    data = file.readAll();
+    if (data.isEmpty()) {
+        // removed behind our back
+        error() << "cache entry gone" << file;
+        remove(it);
+        return false;
+    }
+    mLru.splice(mLru.end(), mLru, it->second.lru);
+    // keep the on-disk order in sync so LRU survives a restart
+    utimes(file.constData(), 0);
+    return true;
+}
+
+static inline bool isKey(const String& key)
+{
+    // keys from peers end up in a path
+    if (key.size() != 64)
+        return false;
+    for (int i=0; i<key.size(); ++i) {
+        const char c = key.at(i);
+        if (!isdigit(c) && (c < 'a' || c > 'f'))
+            return false;
+    }
+    return true;
+}
+
+bool Cache::write(const String& key, const String& data)
+{
+    if (!isEnabled() || data.isEmpty() || static_cast<int64_t>(data.size()) > mMaxSize || !isKey(key))
+        return false;
+
+    // write to a temp file and rename it into place so readers
+    // never see a partially written entry
+    String tmp = mDirectory + "tmpXXXXXX";
+    const int fd = mkstemp(tmp.data());
+    if (fd == -1) {
+        error() << "Unable to mkstemp cache file" << errno;
+        return false;
+    }
+    const char* ptr = data.constData();
+    size_t rem = data.size();
+    while (rem) {
+        const ssize_t w = ::write(fd, ptr, rem);
+        if (w == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        ptr += w;
+        rem -= w;
+    }
+    close(fd);
+    if (rem) {
+        error() << "Unable to write cache file" << tmp << errno;
+        unlink(tmp.constData());
+        return false;
+    }
+
+    const Path file = path(key);
+    file.parentDir().mkdir();
+    if (rename(tmp.constData(), file.constData()) == -1) {
+        error() << "Unable to rename cache file" << tmp << file << errno;
+        unlink(tmp.constData());
+        return false;
+    }
+    auto it = mEntries.find(key);
+    if (it != mEntries.end()) {
+        // replaced, the file itself is already gone
+        mSize -= it->second.size;
+        mLru.erase(it->second.lru);
+        mEntries.erase(it);
+    }
+    add(key, data.size());
+    evict();
+    return true;
+}
+
+bool Cache::get(const String& key, String& data)
+{
+    if (!isEnabled())
+        return false;
+    if (!read(key, data)) {
+        ++mStats.misses;
+        warning() << "cache miss" << key << mStats.hits << "hits" << mStats.misses << "misses";
+        return false;
+    }
+    ++mStats.hits;
+    warning() << "cache hit" << key << mStats.hits << "hits" << mStats.misses << "misses";
+    return true;
+}
+
+void Cache::insert(const String& key, const String& data)
+{
+    if (mEntries.contains(key))
+        return;
+    if (write(key, data))
+        ++mStats.inserts;
+}
+
+namespace {
+enum { ManifestVersion = 1, MaxManifestEntries = 16 };
+
+struct ManifestEntry
+{
+    Map<String, String> includes;
+    String objectKey, dependencies;
+};
+
+inline Serializer& operator<<(Serializer& serializer, const ManifestEntry& entry)
+{
+    serializer << entry.includes << entry.objectKey << entry.dependencies;
+    return serializer;
+}
+
+inline Deserializer& operator>>(Deserializer& deserializer, ManifestEntry& entry)
+{
+    deserializer >> entry.includes >> entry.objectKey >> entry.dependencies;
+    return deserializer;
+}
+}
+
+static inline bool readManifest(const String& data, List<ManifestEntry>& entries)
+{
+    if (data.isEmpty())
+        return false;
+    Deserializer deserializer(data.constData(), data.size());
+    uint32_t version;
+    deserializer >> version;
+    if (version != ManifestVersion)
+        return false;
+    deserializer >> entries;
+    return true;
+}
+
+bool Cache::getDirect(const String& directKey, const Path& cwd, String& objectKey, String& dependencies)
+{
+    String data;
+    List<ManifestEntry> entries;
+    if (!read(directKey, data) || !readManifest(data, entries)) {
+        ++mStats.directMisses;
+        return false;
+    }
+
+    // the same header is usually listed by every entry
+    Hash<String, String> hashes;
+    auto hashFile = [this, &hashes, &cwd](const String& file) -> String {
+        auto it = hashes.find(file);
+        if (it != hashes.end())
+            return it->second;
+        Path path = file;
+        if (!path.isAbsolute())
+            path = cwd + path;
+        const String hash = Cache::hashFile(path);
+        hashes[file] = hash;
+        return hash;
+    };
+
+    for (const ManifestEntry& entry : entries) {
+        bool match = true;
+        for (const auto& include : entry.includes) {
+            if (hashFile(include.first) != include.second) {
+                match = false;
+                break;
+            }
+        }
+        if (match) {
+            ++mStats.directHits;
+            objectKey = entry.objectKey;
+            dependencies = entry.dependencies;
+            return true;
+        }
+    }
+    ++mStats.directMisses;
+    return false;
+}
+
+void Cache::insertDirect(const String& directKey, const Map<String, String>& includes,
+                         const String& objectKey, const String& dependencies)
+{
+    if (!isEnabled())
+        return;
+    String data;
+    List<ManifestEntry> entries;
+    if (read(directKey, data))
+        readManifest(data, entries);
+    for (int i=0; i<entries.size(); ++i) {
+        if (entries.at(i).includes == includes) {
+            entries.removeAt(i);
+            break;
+        }
+    }
+    // newest first, headers tend to change forward
+    entries.prepend({ includes, objectKey, dependencies });
+    while (entries.size() > MaxManifestEntries)
+        entries.removeLast();
+
+    data.clear();
+    {
+        Serializer serializer(data);
+        serializer << static_cast<uint32_t>(ManifestVersion) << entries;
+    }
+    write(directKey, data);
+}
+
+void Cache::add(const String& key, int64_t size)
+{
+    assert(!mEntries.contains(key));
+    mLru.push_back(key);
+    Entry& entry = mEntries[key];
+    entry.size = size;
+    entry.lru = --mLru.end();
+    mSize += size;
+}
+
+void Cache::remove(Hash<String, Entry>::iterator it)
+{
+    Path::rm(path(it->first));
+    mSize -= it->second.size;
+    mLru.erase(it->second.lru);
+    mEntries.erase(it);
+}
+
+void Cache::evict()
+{
+    while (mSize > mMaxSize && !mLru.empty()) {
+        auto it = mEntries.find(mLru.front());
+        assert(it != mEntries.end());
+        remove(it);
+        ++mStats.evictions;
+    }
+}
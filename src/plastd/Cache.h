@@ -0,0 +1,83 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "CompilerVersion.h"
+#include <rct/Hash.h>
+#include <rct/LinkedList.h>
+#include <rct/List.h>
+#include <rct/Map.h>
+#include <rct/Path.h>
+#include <rct/String.h>
+#include <cstdint>
+
+class Cache
+{
+public:
+    Cache();
+    ~Cache();
+
+    bool init(const Path& directory, int64_t maxSize);
+    bool isEnabled() const { return mMaxSize > 0; }
+
+    bool get(const String& key, String& data);
+    void insert(const String& key, const String& data);
+
+    // direct mode, maps a source file and command line to an object
+    // through a manifest of the include files and their content hashes
+    bool getDirect(const String& directKey, const Path& cwd, String& objectKey, String& dependencies);
+    void insertDirect(const String& directKey, const Map<String, String>& includes,
+                      const String& objectKey, const String& dependencies);
+
+    struct Stats
+    {
+        Stats()
+            : hits(0), misses(0), directHits(0), directMisses(0), inserts(0), evictions(0)
+        {
+        }
+
+        uint64_t hits, misses, directHits, directMisses, inserts, evictions;
+    };
+    const Stats& stats() const { return mStats; }
+    int64_t size() const { return mSize; }
+    int64_t maxSize() const { return mMaxSize; }
+
+    static String objectKey(const String& preprocessedHash, const CompilerVersion::SharedPtr& version,
+                            const List<String>& args, const Path& cwd = Path());
+    static String directKey(const Path& source, const String& sourceHash, const CompilerVersion::SharedPtr& version,
+                            const List<String>& args, const Path& cwd);
+
+    // content hash of a file, remembered for as long as its size,
+    // inode and modification time stay the same. Empty if it's gone
+    String hashFile(const Path& path);
+
+private:
+    struct Entry
+    {
+        int64_t size;
+        LinkedList<String>::iterator lru;
+    };
+
+    Path path(const String& key) const;
+    bool read(const String& key, String& data);
+    bool write(const String& key, const String& data);
+    void add(const String& key, int64_t size);
+    void remove(Hash<String, Entry>::iterator it);
+    void evict();
+
+    struct FileHash
+    {
+        uint64_t inode, size, modified;
+        String hash;
+    };
+
+private:
+    Path mDirectory;
+    int64_t mMaxSize, mSize;
+    Hash<String, Entry> mEntries;
+    // least recently used at the front
+    LinkedList<String> mLru;
+    Hash<String, FileHash> mFileHashes;
+    Stats mStats;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#include "CacheRing.h"
+#include <rct/Log.h>
+#include <rct/Sha256.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint64_t position(const String& hash)
+{
+    // hex encoded, 16 chars make 64 bits
+    return strtoull(hash.left(16).constData(), 0, 16);
+}
+
+CacheRing::CacheRing()
+{
+}
+
+void CacheRing::setMembers(const List<Member>& members)
+{
+    mMembers = members;
+    mRing.clear();
+    for (int i=0; i<mMembers.size(); ++i) {
+        const Member& member = mMembers.at(i);
+        for (int node=0; node<VirtualNodes; ++node) {
+            const String name = String::format<128>("%s:%d#%d", member.host.constData(), member.port, node);
+            mRing[position(Sha256::hash(name, Sha256::Hex))] = i;
+        }
+    }
+    warning() << "cache ring has" << mMembers.size() << "members";
+}
+
+bool CacheRing::owner(const String& key, Member& member) const
+{
+    if (mRing.isEmpty())
+        return false;
+    auto it = mRing.lower_bound(position(key));
+    if (it == mRing.end())
+        it = mRing.begin();
+    member = mMembers.at(it->second);
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef CACHERING_H
+#define CACHERING_H
+
+#include <rct/List.h>
+#include <rct/Map.h>
+#include <rct/String.h>
+#include <cstdint>
+
+// consistent hash ring deciding which peer owns a cache key, only
+// the keys of a joining or leaving peer move when membership changes
+class CacheRing
+{
+public:
+    struct Member
+    {
+        String host;
+        uint16_t port;
+        bool self;
+    };
+
+    CacheRing();
+
+    void setMembers(const List<Member>& members);
+    bool isEmpty() const { return mRing.isEmpty(); }
+    int size() const { return mMembers.size(); }
+
+    // returns false if the ring is empty
+    bool owner(const String& key, Member& member) const;
+
+private:
+    enum { VirtualNodes = 64 };
+
+    List<Member> mMembers;
+    Map<uint64_t, int> mRing;
+};
+
+#endif
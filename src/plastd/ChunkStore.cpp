@@ -0,0 +1,135 @@
+#include "ChunkStore.h"
+#include <rct/Log.h>
+#include <rct/Sha256.h>
+#include <assert.h>
+
+namespace {
+enum {
+    MinChunkSize = 2 * 1024,
+    MaxChunkSize = 64 * 1024,
+    // 13 bits for an average of 8k past the minimum
+    ChunkMask = (1 << 13) - 1
+};
+
+struct GearTable
+{
+    GearTable()
+    {
+        // fixed seed, both ends have to split the same way
+        uint64_t seed = 0x9e3779b97f4a7c15ULL;
+        for (int i=0; i<256; ++i) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            gear[i] = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t gear[256];
+};
+}
+
+ChunkStore::ChunkStore(Mode mode, int64_t maxSize)
+    : mMode(mode), mMaxSize(maxSize), mSize(0)
+{
+}
+
+List<uint32_t> ChunkStore::split(const String& data)
+{
+    static const GearTable table;
+    List<uint32_t> ends;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.constData());
+    const uint32_t size = data.size();
+    uint32_t start = 0;
+    while (start < size) {
+        uint32_t end = std::min<uint32_t>(start + MaxChunkSize, size);
+        if (end - start > MinChunkSize) {
+            uint64_t hash = 0;
+            for (uint32_t i = start + MinChunkSize; i < end; ++i) {
+                hash = (hash << 1) + table.gear[bytes[i]];
+                if (!(hash & ChunkMask)) {
+                    end = i + 1;
+                    break;
+                }
+            }
+        }
+        ends.append(end);
+        start = end;
+    }
+    return ends;
+}
+
+ChunkStore::Entry* ChunkStore::find(const String& hash)
+{
+    auto it = mEntries.find(hash);
+    if (it == mEntries.end())
+        return 0;
+    mLru.splice(mLru.end(), mLru, it->second.lru);
+    return &it->second;
+}
+
+void ChunkStore::insert(const String& hash, uint32_t size, const String& data)
+{
+    assert(!mEntries.contains(hash));
+    mLru.push_back(hash);
+    Entry& entry = mEntries[hash];
+    entry.size = size;
+    entry.lru = --mLru.end();
+    if (mMode == Data)
+        entry.data = data;
+    mSize += size;
+    while (mSize > mMaxSize && !mLru.empty()) {
+        auto it = mEntries.find(mLru.front());
+        assert(it != mEntries.end());
+        mSize -= it->second.size;
+        mEntries.erase(it);
+        mLru.pop_front();
+    }
+}
+
+void ChunkStore::encode(const String& data, List<String>& hashes, List<uint32_t>& sizes, String& literal)
+{
+    assert(mMode == Mirror);
+    uint32_t start = 0;
+    for (uint32_t end : split(data)) {
+        const String chunk = data.mid(start, end - start);
+        const String hash = Sha256::hash(chunk, Sha256::Hex);
+        hashes.append(hash);
+        if (find(hash)) {
+            sizes.append(0);
+        } else {
+            sizes.append(chunk.size());
+            literal.append(chunk);
+            insert(hash, chunk.size(), String());
+        }
+        start = end;
+    }
+}
+
+bool ChunkStore::decode(const List<String>& hashes, const List<uint32_t>& sizes, const String& literal, String& data)
+{
+    assert(mMode == Data);
+    if (hashes.size() != sizes.size())
+        return false;
+    size_t offset = 0;
+    for (int i=0; i<hashes.size(); ++i) {
+        const String& hash = hashes.at(i);
+        const uint32_t size = sizes.at(i);
+        if (!size) {
+            const Entry* entry = find(hash);
+            if (!entry) {
+                error() << "chunk missing from store" << hash;
+                return false;
+            }
+            data.append(entry->data);
+        } else {
+            if (offset + size > literal.size() || mEntries.contains(hash))
+                return false;
+            const String chunk = literal.mid(offset, size);
+            offset += size;
+            data.append(chunk);
+            insert(hash, size, chunk);
+        }
+    }
+    return offset == literal.size();
+}
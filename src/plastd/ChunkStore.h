@@ -0,0 +1,51 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <rct/Hash.h>
+#include <rct/LinkedList.h>
+#include <rct/List.h>
+#include <rct/String.h>
+#include <cstdint>
+
+// bounded lru of content defined chunks for one direction of a peer
+// connection. the sending side keeps a mirror without the data and
+// makes the same inserts and lookups in the same order as the
+// receiving side, so both evict the same chunks and a chunk is only
+// referenced while the receiver still has it
+class ChunkStore
+{
+public:
+    enum Mode { Mirror, Data };
+
+    ChunkStore(Mode mode, int64_t maxSize);
+
+    // sender, chunks the peer doesn't have go into literal
+    void encode(const String& data, List<String>& hashes, List<uint32_t>& sizes, String& literal);
+    // receiver, returns false if the stores got out of sync
+    bool decode(const List<String>& hashes, const List<uint32_t>& sizes, const String& literal, String& data);
+
+    int64_t size() const { return mSize; }
+
+    // split points from a rolling gear hash, end offsets of each chunk
+    static List<uint32_t> split(const String& data);
+
+private:
+    struct Entry
+    {
+        String data;
+        uint32_t size;
+        LinkedList<String>::iterator lru;
+    };
+
+    Entry* find(const String& hash);
+    void insert(const String& hash, uint32_t size, const String& data);
+
+private:
+    Mode mMode;
+    int64_t mMaxSize, mSize;
+    Hash<String, Entry> mEntries;
+    // least recently used at the front
+    LinkedList<String> mLru;
+};
+
+#endif
@@ -139,6 +139,41 @@ std::shared_ptr<CompilerArgs> CompilerArgs::create(const List<String> &args)
     return ret;
 }
 
+List<String> CompilerArgs::normalized() const
+{
+    static const char *withArg[] = {
+        "-D", "-I", "-MF", "-MQ", "-MT", "-U", "-idirafter", "-imacros", "-include",
+        "-iprefix", "-iquote", "-isysroot", "-isystem", "-iwithprefix", "-iwithprefixbefore", "-o"
+    };
+    static const char *joined[] = { "-D", "-I", "-MF", "-MQ", "-MT", "-U" };
+    static const char *single[] = { "-M", "-MD", "-MG", "-MM", "-MMD", "-MP" };
+
+    List<String> ret;
+    ret.reserve(commandLine.size());
+    for (int i=1; i<commandLine.size(); ++i) {
+        if (sourceFileIndexes.contains(i))
+            continue;
+        const String &arg = commandLine.at(i);
+        bool skip = false;
+        for (const char *opt : withArg) {
+            if (arg == opt) {
+                ++i;
+                skip = true;
+                break;
+            }
+        }
+        for (size_t j=0; !skip && j<sizeof(joined) / sizeof(joined[0]); ++j) {
+            skip = arg.startsWith(joined[j]);
+        }
+        for (size_t j=0; !skip && j<sizeof(single) / sizeof(single[0]); ++j) {
+            skip = (arg == single[j]);
+        }
+        if (!skip)
+            ret.append(arg);
+    }
+    return ret;
+}
+
 const char *CompilerArgs::languageName(Flag flag, bool preprocessed)
 {
     if (preprocessed) {
@@ -85,6 +85,10 @@ struct CompilerArgs
 
     static std::shared_ptr<CompilerArgs> create(const List<String> &args);
 
+    // command line without compiler, inputs, outputs and options that
+    // only affect preprocessing or dependency generation
+    List<String> normalized() const;
+
     Path sourceFile(int idx = 0) const { return commandLine.value(sourceFileIndexes.value(idx, -1)); }
     Path output() const
     {
@@ -1,10 +1,17 @@
 #include "CompilerVersion.h"
 #include <rct/Process.h>
 #include <rct/Log.h>
+#include <rct/Sha256.h>
+#include <rct/EventLoop.h>
 #include <regex>
+#include <thread>
+#include <stdio.h>
 
 Map<CompilerVersion::PathKey, CompilerVersion::SharedPtr> CompilerVersion::sVersions;
 Map<plast::CompilerKey, CompilerVersion::WeakPtr> CompilerVersion::sVersionsByKey;
+uint32_t CompilerVersion::sGeneration = 0;
+Hash<Path, String> CompilerVersion::sHashes;
+Set<Path> CompilerVersion::sHashing;
 
 CompilerVersion::CompilerVersion(const Path& path, uint32_t flags, const String& target)
     : mCompiler(plast::Unknown)
@@ -86,6 +93,7 @@ CompilerVersion::SharedPtr CompilerVersion::version(const Path& path, uint32_t f
         }
         sVersions[k] = ver;
         sVersionsByKey[{ ver->compiler(), ver->major(), ver->target() }] = ver;
+        ++sGeneration;
         error() << "registered compiler" << path << ver->compiler() << ver->major() << ver->target();
         return ver;
     }
@@ -105,3 +113,76 @@ CompilerVersion::SharedPtr CompilerVersion::version(plast::CompilerType type, in
     }
     return v->second.lock();
 }
+
+List<CompilerVersion::SharedPtr> CompilerVersion::versions()
+{
+    List<SharedPtr> ret;
+    for (const auto& v : sVersionsByKey) {
+        if (SharedPtr ver = v.second.lock())
+            ret.append(ver);
+    }
+    return ret;
+}
+
+void CompilerVersion::prune()
+{
+    bool pruned = false;
+    auto it = sVersions.begin();
+    while (it != sVersions.end()) {
+        if (it->first.path.isExecutable()) {
+            ++it;
+            continue;
+        }
+        error() << "compiler gone" << it->first.path;
+        sHashes.erase(it->first.path);
+        sVersions.erase(it++);
+        pruned = true;
+    }
+    if (!pruned)
+        return;
+    // another binary may still provide the same key
+    sVersionsByKey.clear();
+    for (const auto& v : sVersions) {
+        sVersionsByKey[{ v.second->compiler(), v.second->major(), v.second->target() }] = v.second;
+    }
+    ++sGeneration;
+}
+
+static String hashFile(const Path& path)
+{
+    FILE* f = fopen(path.constData(), "r");
+    if (!f)
+        return String();
+    Sha256 sha;
+    char buf[64 * 1024];
+    size_t total = 0, r;
+    while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
+        sha.update(String(buf, r));
+        total += r;
+    }
+    const bool ok = !ferror(f) && total;
+    fclose(f);
+    return ok ? sha.hash(Sha256::Hex) : String();
+}
+
+String CompilerVersion::hash() const
+{
+    const Path& path = mKey.path;
+    auto it = sHashes.find(path);
+    if (it != sHashes.end())
+        return it->second;
+    if (sHashing.contains(path))
+        return String();
+    sHashing.insert(path);
+    const EventLoop::SharedPtr loop = EventLoop::eventLoop();
+    std::thread([loop, path]() {
+            const String hash = hashFile(path);
+            loop->callLater([path, hash]() {
+                    sHashing.remove(path);
+                    sHashes[path] = hash;
+                    // so that it gets reported
+                    ++sGeneration;
+                });
+        }).detach();
+    return String();
+}
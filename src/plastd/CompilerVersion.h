@@ -21,6 +21,12 @@ public:
     static SharedPtr version(const Path& path, uint32_t flags = 0, const String& target = String());
     static SharedPtr version(plast::CompilerType compiler, int32_t major, const String& target);
     static bool hasCompiler(plast::CompilerType compiler, int32_t major, const String& target);
+    // one per compiler key
+    static List<SharedPtr> versions();
+    // forget compilers that are gone from disk
+    static void prune();
+    // changes whenever compilers come or go, or a hash is known
+    static uint32_t generation() { return sGeneration; }
 
     plast::CompilerType compiler() const { return mCompiler; }
 
@@ -35,6 +41,9 @@ public:
     void setExtraArgs(const List<String>& extra) { mExtraArgs = extra; }
 
     Path path() const { return mKey.path; }
+    // sha256 of the binary, empty until known. the first call starts
+    // reading it on a thread of its own, compilers are big
+    String hash() const;
 
     bool isValid() { return mCompiler != plast::Unknown; }
 
@@ -70,6 +79,10 @@ private:
     } mKey;
     static Map<PathKey, SharedPtr> sVersions;
     static Map<plast::CompilerKey, WeakPtr> sVersionsByKey;
+    static uint32_t sGeneration;
+    // by binary, shared by all the versions that run it
+    static Hash<Path, String> sHashes;
+    static Set<Path> sHashing;
 
 private:
     CompilerVersion(const Path& path, uint32_t flags, const String& target);
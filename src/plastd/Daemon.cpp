@@ -219,9 +219,26 @@ bool Daemon::init()
 
     sInstance = shared_from_this();
     messages::init();
+    mCache.init(mOptions.cacheDirectory + "objects/", mOptions.cacheSize);
     mLocal.init();
     mRemote.init();
 
+    // remote picks up the new set and tells the scheduler
+    mCompilersTimer.timeout().connect([this](Timer*) {
+            CompilerVersion::prune();
+            updateCompilers();
+        });
+    auto compilersChanged = [this](const Path&) {
+        // editors tend to touch a file more than once
+        mCompilersTimer.restart(CompilersDelay, Timer::SingleShot);
+    };
+    mWatcher.added().connect(compilersChanged);
+    mWatcher.removed().connect(compilersChanged);
+    mWatcher.modified().connect(compilersChanged);
+    mWatcher.watch(PLAST_DATA_PREFIX "/etc/plast/");
+    mWatcher.watch(PLAST_DATA_PREFIX "/etc/plast/compilers.d/");
+    mWatcher.watch(Path::home() + ".config/plast/");
+
     mHostName.resize(sysconf(_SC_HOST_NAME_MAX));
     if (gethostname(mHostName.data(), mHostName.size()) == 0) {
         mHostName.resize(strlen(mHostName.constData()));
@@ -1,12 +1,15 @@
 #ifndef DAEMON_H
 #define DAEMON_H
 
+#include "Cache.h"
 #include "Local.h"
 #include "Remote.h"
 #include <Messages.h>
 #include <rct/SocketClient.h>
 #include <rct/SocketServer.h>
 #include <rct/Connection.h>
+#include <rct/FileSystemWatcher.h>
+#include <rct/Timer.h>
 #include <memory>
 
 class Daemon : public std::enable_shared_from_this<Daemon>
@@ -28,6 +31,10 @@ public:
         int overcommit;
         int maxPreprocessPending;
         Path cacheDirectory;
+        int64_t cacheSize;
+        bool directMode;
+        uint32_t compression;
+        bool pump;
     };
 
     Daemon(const Options& opts);
@@ -39,6 +46,7 @@ public:
 
     Local& local() { return mLocal; }
     Remote& remote() { return mRemote; }
+    Cache& cache() { return mCache; }
     const Options& options() const { return mOptions; }
 
     static SharedPtr instance();
@@ -52,9 +60,14 @@ private:
     SocketServer mServer;
     Local mLocal;
     Remote mRemote;
+    Cache mCache;
     Options mOptions;
     int mExitCode;
     String mHostName;
+    // compiler lists changing on disk
+    FileSystemWatcher mWatcher;
+    Timer mCompilersTimer;
+    enum { CompilersDelay = 1000 };
 
 private:
     static WeakPtr sInstance;
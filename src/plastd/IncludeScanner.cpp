@@ -0,0 +1,213 @@
+#include "IncludeScanner.h"
+#include <rct/Log.h>
+#include <rct/Process.h>
+#include <rct/Set.h>
+#include <rct/Sha256.h>
+#include <ctype.h>
+#include <string.h>
+
+Hash<Path, IncludeScanner::File> IncludeScanner::sFiles;
+Map<std::pair<Path, String>, List<Path> > IncludeScanner::sSystemDirs;
+
+enum { MaxClosure = 20000 };
+
+static inline const char* skipSpace(const char* ptr, const char* end)
+{
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+        ++ptr;
+    return ptr;
+}
+
+IncludeScanner::File* IncludeScanner::file(const Path& path)
+{
+    const uint64_t modified = path.lastModifiedMs();
+    auto it = sFiles.find(path);
+    if (it != sFiles.end() && it->second.modified == modified)
+        return &it->second;
+    if (!path.isFile())
+        return 0;
+
+    File& f = sFiles[path];
+    f.modified = modified;
+    f.computed = false;
+    f.includes.clear();
+    f.hash.clear();
+
+    const String data = path.readAll();
+    const char* ptr = data.constData();
+    const char* const end = ptr + data.size();
+    while (ptr < end) {
+        const char* eol = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+        if (!eol)
+            eol = end;
+        const char* p = skipSpace(ptr, eol);
+        if (p < eol && *p == '#') {
+            p = skipSpace(p + 1, eol);
+            const char* word = p;
+            while (p < eol && isalpha(*p))
+                p += 1;
+            const String directive(word, p - word);
+            if (directive == "include" || directive == "include_next" || directive == "import") {
+                p = skipSpace(p, eol);
+                const char close = (p < eol && *p == '<') ? '>' : (p < eol && *p == '"') ? '"' : 0;
+                const char* last = close ? static_cast<const char*>(memchr(p + 1, close, eol - p - 1)) : 0;
+                if (!last) {
+                    // #include MACRO, only the preprocessor knows
+                    f.computed = true;
+                } else {
+                    f.includes.append({ String(p + 1, last - p - 1), close == '>', directive == "include_next" });
+                }
+            }
+        }
+        ptr = eol + 1;
+    }
+    return &f;
+}
+
+String IncludeScanner::hash(const Path& path)
+{
+    File* f = file(path);
+    if (!f)
+        return String();
+    if (f->hash.isEmpty())
+        f->hash = Sha256::hash(path.readAll(), Sha256::Hex);
+    return f->hash;
+}
+
+List<Path> IncludeScanner::systemIncludeDirs(const Path& compiler, const std::shared_ptr<CompilerArgs>& args)
+{
+    List<String> cmdline;
+    String lang = CompilerArgs::languageName(static_cast<CompilerArgs::Flag>(args->flags & CompilerArgs::LanguageMask));
+    if (lang.isEmpty())
+        lang = "c";
+    cmdline << "-x" << lang;
+    // the options that change the built in search path
+    for (int i=1; i<args->commandLine.size(); ++i) {
+        const String& arg = args->commandLine.at(i);
+        if (arg == "-m32" || arg == "-m64" || arg == "-nostdinc" || arg == "-nostdinc++"
+            || arg.startsWith("-stdlib=") || arg.startsWith("--sysroot") || arg.startsWith("-std=")) {
+            cmdline << arg;
+        } else if (arg == "-target" || arg == "-isysroot") {
+            cmdline << arg << args->commandLine.value(++i);
+        }
+    }
+    const std::pair<Path, String> key(compiler, String::join(cmdline, ' '));
+    auto it = sSystemDirs.find(key);
+    if (it != sSystemDirs.end())
+        return it->second;
+
+    cmdline << "-E" << "-v" << "/dev/null";
+    List<Path> dirs;
+    Process proc;
+    if (proc.exec(compiler, cmdline) == Process::Done) {
+        bool inList = false;
+        for (const String& line : proc.readAllStdErr().split('\n')) {
+            if (line.startsWith("#include <...> search starts here:")) {
+                inList = true;
+            } else if (line.startsWith("End of search list.")) {
+                break;
+            } else if (inList && line.startsWith(" ") && !line.endsWith("(framework directory)")) {
+                dirs.append(Path(line.mid(1)).ensureTrailingSlash());
+            }
+        }
+    }
+    sSystemDirs[key] = dirs;
+    return dirs;
+}
+
+bool IncludeScanner::scan(const Path& compiler, const std::shared_ptr<CompilerArgs>& args, const Path& cwd,
+                          List<Path>& files, List<Path>& systemDirs)
+{
+    const Path root = cwd.ensureTrailingSlash();
+    auto absolute = [&root](const Path& path) -> Path {
+        if (path.isAbsolute())
+            return path;
+        return root + path;
+    };
+
+    List<Path> quoteDirs, angleDirs, afterDirs, forced;
+    const List<String>& cmdline = args->commandLine;
+    for (int i=1; i<cmdline.size(); ++i) {
+        const String& arg = cmdline.at(i);
+        auto value = [&](const char* option) -> String {
+            const int len = strlen(option);
+            if (arg.size() > len)
+                return arg.mid(len);
+            return cmdline.value(++i);
+        };
+        if (arg.startsWith("-I")) {
+            angleDirs.append(absolute(value("-I")).ensureTrailingSlash());
+        } else if (arg.startsWith("-iquote")) {
+            quoteDirs.append(absolute(value("-iquote")).ensureTrailingSlash());
+        } else if (arg.startsWith("-isystem")) {
+            angleDirs.append(absolute(value("-isystem")).ensureTrailingSlash());
+        } else if (arg.startsWith("-idirafter")) {
+            afterDirs.append(absolute(value("-idirafter")).ensureTrailingSlash());
+        } else if (arg == "-include" || arg == "-imacros") {
+            forced.append(absolute(cmdline.value(++i)));
+        } else if (arg.startsWith("-iprefix") || arg.startsWith("-iwithprefix") || arg.startsWith("-F")) {
+            // not worth modelling
+            return false;
+        }
+    }
+    systemDirs = systemIncludeDirs(compiler, args);
+    angleDirs << systemDirs << afterDirs;
+
+    Set<Path> seen;
+    List<Path> queue;
+    auto add = [&](const Path& path) {
+        if (!seen.contains(path)) {
+            seen.insert(path);
+            queue.append(path);
+        }
+    };
+    add(absolute(args->sourceFile()));
+    for (const Path& path : forced) {
+        add(path);
+    }
+
+    for (int idx=0; idx<queue.size(); ++idx) {
+        const Path current = queue.at(idx);
+        const File* f = file(current);
+        if (!f) {
+            if (current == absolute(args->sourceFile()))
+                return false;
+            continue;
+        }
+        if (f->computed) {
+            warning() << "computed include in" << current << "can't pump";
+            return false;
+        }
+        files.append(current);
+        if (files.size() > MaxClosure)
+            return false;
+        for (const Include& include : f->includes) {
+            if (!include.angled && !include.next) {
+                const Path local = current.parentDir().ensureTrailingSlash() + include.name;
+                if (local.isFile()) {
+                    add(local);
+                    continue;
+                }
+            }
+            bool found = false;
+            for (const List<Path>* dirs : { &quoteDirs, &angleDirs }) {
+                if (include.angled && dirs == &quoteDirs)
+                    continue;
+                for (const Path& dir : *dirs) {
+                    const Path candidate = dir + include.name;
+                    if (candidate.isFile()) {
+                        add(candidate);
+                        found = true;
+                        // include_next could land on any of the later ones
+                        if (!include.next)
+                            break;
+                    }
+                }
+                if (found && !include.next)
+                    break;
+            }
+            // not found is fine, it might be behind an #if
+        }
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef INCLUDESCANNER_H
+#define INCLUDESCANNER_H
+
+#include "CompilerArgs.h"
+#include <rct/Hash.h>
+#include <rct/List.h>
+#include <rct/Map.h>
+#include <rct/Path.h>
+#include <rct/String.h>
+#include <memory>
+#include <cstdint>
+
+// finds the include closure of a source file without running the
+// preprocessor. every #include is followed regardless of #if so the
+// closure is a superset, the directives of each file are only parsed
+// once as long as it doesn't change
+class IncludeScanner
+{
+public:
+    // returns false if the closure can't be known up front, e.g. for
+    // computed includes
+    static bool scan(const Path& compiler, const std::shared_ptr<CompilerArgs>& args, const Path& cwd,
+                     List<Path>& files, List<Path>& systemDirs);
+
+    // content hash, cached until the file changes
+    static String hash(const Path& file);
+
+private:
+    struct Include
+    {
+        String name;
+        bool angled, next;
+    };
+    struct File
+    {
+        uint64_t modified;
+        bool computed;
+        List<Include> includes;
+        String hash;
+    };
+
+    static File* file(const Path& path);
+    static List<Path> systemIncludeDirs(const Path& compiler, const std::shared_ptr<CompilerArgs>& args);
+
+    static Hash<Path, File> sFiles;
+    static Map<std::pair<Path, String>, List<Path> > sSystemDirs;
+};
+
+#endif
@@ -3,16 +3,23 @@
 #include "CompilerVersion.h"
 #include "Local.h"
 #include "Daemon.h"
+#include "IncludeScanner.h"
+#include <rct/Rct.h>
+#include <rct/Sha256.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <ftw.h>
 
 Hash<uint64_t, Job::SharedPtr> Job::sJobs;
 uint64_t Job::sNextId = 0;
 
 Job::Job(const Path& path, const List<String>& args, Type type,
-         uint64_t remoteId, const String& preprocessed, uint32_t serial, const String& remoteName,
+         uint64_t remoteId, const plast::Buffer& preprocessed, uint32_t serial, const String& remoteName,
          plast::CompilerType ctype, int cmajor, const String& ctarget)
     : mArgs(args), mPath(path), mRemoteId(remoteId), mPreprocessed(preprocessed),
-      mStatus(Idle), mType(type), mSerial(serial), mId(++sNextId), mRemoteName(remoteName),
+      mStarted(Rct::currentTimeMs()), mHasDiagnostics(false), mStreamed(false),
+      mPumped(false), mPumpFailed(false), mStatus(Idle), mType(type), mSerial(serial), mId(++sNextId), mRemoteName(remoteName),
       mCompilerType(ctype), mCompilerMajor(cmajor), mCompilerTarget(ctarget), mExitCode(0)
 {
     assert(!mArgs.isEmpty());
@@ -21,11 +28,11 @@ Job::Job(const Path& path, const List<String>& args, Type type,
         mCompilerArgs = CompilerArgs::create(mArgs);
         mResolvedCompiler = plast::resolveCompiler(mArgs.front());
         if (!mResolvedCompiler.isEmpty()) {
-            CompilerVersion::SharedPtr version = CompilerVersion::version(mResolvedCompiler, mCompilerArgs->flags);
-            if (version) {
-                mCompilerType = version->compiler();
-                mCompilerMajor = version->major();
-                mCompilerTarget = version->target();
+            mCompilerVersion = CompilerVersion::version(mResolvedCompiler, mCompilerArgs->flags);
+            if (mCompilerVersion) {
+                mCompilerType = mCompilerVersion->compiler();
+                mCompilerMajor = mCompilerVersion->major();
+                mCompilerTarget = mCompilerVersion->target();
             }
         } else {
 #warning handle me
@@ -37,6 +44,7 @@ Job::Job(const Path& path, const List<String>& args, Type type,
 #warning handle me
             return;
         }
+        mCompilerVersion = version;
         mResolvedCompiler = version->path();
         assert(ctype == version->compiler());
         assert(cmajor == version->major());
@@ -50,14 +58,22 @@ Job::Job(const Path& path, const List<String>& args, Type type,
     }
 }
 
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+    remove(path);
+    return 0;
+}
+
 Job::~Job()
 {
     mDestroyed(this);
+    if (!mPumpRoot.isEmpty())
+        nftw(mPumpRoot.constData(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
 }
 
 Job::SharedPtr Job::create(const Path& path, const List<String>& args, Type type,
                            const String& remoteName, uint64_t remoteId,
-                           const String& preprocessed, uint32_t serial,
+                           const plast::Buffer& preprocessed, uint32_t serial,
                            plast::CompilerType ctype, int cmajor, const String& ctarget)
 {
     Job::SharedPtr job(new Job(path, args, type, remoteId, preprocessed, serial, remoteName, ctype, cmajor, ctarget));
@@ -84,16 +100,292 @@ static inline bool isObjectiveC(const std::shared_ptr<CompilerArgs> &args)
 
 void Job::start()
 {
-    Local& local = Daemon::instance()->local();
+    Daemon::SharedPtr daemon = Daemon::instance();
+    Local& local = daemon->local();
     if (mCompilerArgs->mode != CompilerArgs::Compile) {
         assert(mType == LocalJob);
         local.run(shared_from_this());
-    } else if (local.isAvailable() || mType == RemoteJob || mCompilerArgs->sourceFileIndexes.size() != 1 || isObjectiveC(mCompilerArgs)) {
+        return;
+    }
+    if (daemon->cache().isEnabled() && isCacheable()) {
+        if (isPreprocessed()) {
+            if (startFromCache())
+                return;
+        } else if (mType == LocalJob && mCacheKey.isEmpty()) {
+            if (daemon->options().directMode && mDirectKey.isEmpty() && startFromDirectCache())
+                return;
+            if (!local.isAvailable() && startPumped())
+                return;
+            // we need the preprocessed output for the cache key,
+            // remote will look us up once preprocessing is done
+            mPumped = false;
+            daemon->remote().post(shared_from_this());
+            return;
+        }
+    }
+    if (local.isAvailable() || mType == RemoteJob || mCompilerArgs->sourceFileIndexes.size() != 1 || isObjectiveC(mCompilerArgs)) {
         local.post(shared_from_this());
     } else {
         assert(mType == LocalJob);
-        Daemon::instance()->remote().post(shared_from_this());
+        if (!startPumped())
+            daemon->remote().post(shared_from_this());
+    }
+}
+
+bool Job::startPumped()
+{
+    Daemon::SharedPtr daemon = Daemon::instance();
+    if (!daemon->options().pump || mType != LocalJob || mPumpFailed || isPreprocessed() || !isCacheable())
+        return false;
+    if (!mPumped) {
+        mPumpFiles.clear();
+        mPumpSystemDirs.clear();
+        if (!IncludeScanner::scan(mResolvedCompiler, mCompilerArgs, mPath, mPumpFiles, mPumpSystemDirs)) {
+            mPumpFailed = true;
+            return false;
+        }
+        warning() << "pumping job" << mId << "with" << mPumpFiles.size() << "files";
+        mPumped = true;
+    }
+    daemon->remote().post(shared_from_this());
+    return true;
+}
+
+void Job::stopPumping()
+{
+    // preprocess ourselves from now on
+    mPumped = false;
+    mPumpFailed = true;
+    mPumpFiles.clear();
+    mRemoteStdOut.clear();
+    mRemoteStdErr.clear();
+}
+
+bool Job::isCacheable() const
+{
+    return (mCompilerVersion
+            && mCompilerArgs->mode == CompilerArgs::Compile
+            && mCompilerArgs->sourceFileIndexes.size() == 1
+            && !(mCompilerArgs->flags & CompilerArgs::StdinInput)
+            && !isObjectiveC(mCompilerArgs));
+}
+
+String Job::preprocessedHash()
+{
+    if (mPreprocessedHash.isEmpty()) {
+        assert(isPreprocessed());
+        mPreprocessedHash = Sha256::hash(mPreprocessed.string(), Sha256::Hex);
+    }
+    return mPreprocessedHash;
+}
+
+void Job::computeCacheKey()
+{
+    if (!mCacheKey.isEmpty() || !isCacheable())
+        return;
+    // debug info refers to the working directory
+    Path cwd;
+    for (const String& arg : mCompilerArgs->commandLine) {
+        if (arg.startsWith("-g") && arg != "-g0") {
+            cwd = mPath;
+            break;
+        }
+    }
+    mCacheKey = Cache::objectKey(preprocessedHash(), mCompilerVersion, mCompilerArgs->normalized(), cwd);
+    if (!mDirectKey.isEmpty() && !collectIncludes())
+        mDirectKey.clear();
+}
+
+bool Job::findInCache(String& data)
+{
+    // computed even without a cache, identical jobs are coalesced by key
+    computeCacheKey();
+    if (mCacheKey.isEmpty())
+        return false;
+    return Daemon::instance()->cache().get(mCacheKey, data);
+}
+
+bool Job::startFromCache()
+{
+    String data;
+    if (!findInCache(data))
+        return false;
+    addToDirectCache();
+    error() << "job" << mId << "served from cache" << mCacheKey;
+    finishFromCache(std::move(data));
+    return true;
+}
+
+void Job::finishFromCache(String&& data)
+{
+    if (mType == RemoteJob) {
+        mObjectCode = std::move(data);
+    } else {
+        writeFile(data);
+        if (mStatus == Error) {
+            Job::finish(this);
+            return;
+        }
+    }
+    updateStatus(Compiled);
+    Job::finish(this);
+}
+
+void Job::finishFromIdentical(const Job* identical, String&& objectCode)
+{
+    if (!identical->mCompileStdOut.isEmpty()) {
+        mStdOut += identical->mCompileStdOut;
+        mReadyReadStdOut(this);
+    }
+    if (!identical->mCompileStdErr.isEmpty()) {
+        mStdErr += identical->mCompileStdErr;
+        mReadyReadStdErr(this);
+    }
+    addToDirectCache();
+    finishFromCache(std::move(objectCode));
+}
+
+void Job::addToCache(const String& objectCode)
+{
+    // don't cache compiles that produced diagnostics since we'd
+    // silently drop them on a hit
+    if (mCacheKey.isEmpty() || mHasDiagnostics || objectCode.isEmpty()
+        || !Daemon::instance()->cache().isEnabled()) {
+        return;
+    }
+    Daemon::instance()->cache().insert(mCacheKey, objectCode);
+    if (mType == LocalJob)
+        Daemon::instance()->remote().storeInCluster(mCacheKey, objectCode);
+    addToDirectCache();
+}
+
+Path Job::dependencyFile() const
+{
+    bool wantsDeps = false;
+    Path file;
+    const List<String>& cmdline = mCompilerArgs->commandLine;
+    for (int i=1; i<cmdline.size(); ++i) {
+        const String& arg = cmdline.at(i);
+        if (arg == "-MD" || arg == "-MMD") {
+            wantsDeps = true;
+        } else if (arg == "-MF") {
+            file = cmdline.value(++i);
+        } else if (arg.startsWith("-MF")) {
+            file = arg.mid(3);
+        }
+    }
+    if (!wantsDeps || file.isEmpty())
+        return Path();
+    if (!file.isAbsolute())
+        file = mPath.ensureTrailingSlash() + file;
+    return file;
+}
+
+bool Job::startFromDirectCache()
+{
+    assert(mType == LocalJob);
+    assert(!isPreprocessed());
+    const bool wantsDeps = ((mCompilerArgs->flags & CompilerArgs::HasDashMMD)
+                            || mCompilerArgs->commandLine.contains("-MD"));
+    const Path depFile = dependencyFile();
+    if (wantsDeps && depFile.isEmpty()) {
+        // we don't know where the compiler would put it
+        return false;
+    }
+    Cache& cache = Daemon::instance()->cache();
+    const Path source = mCompilerArgs->sourceFile().resolved(Path::MakeAbsolute, mPath);
+    const String sourceHash = cache.hashFile(source);
+    if (sourceHash.isEmpty())
+        return false;
+
+    // everything but the inputs, the object file name only
+    // matters if it ends up in the dependency file
+    List<String> args;
+    const List<String>& cmdline = mCompilerArgs->commandLine;
+    for (int i=1; i<cmdline.size(); ++i) {
+        if (mCompilerArgs->sourceFileIndexes.contains(i))
+            continue;
+        if (!wantsDeps && i == mCompilerArgs->objectFileIndex)
+            continue;
+        args.append(cmdline.at(i));
+    }
+    mDirectKey = Cache::directKey(source, sourceHash, mCompilerVersion, args, mPath);
+
+    String objectKey, dependencies, data;
+    if (!cache.getDirect(mDirectKey, mPath.ensureTrailingSlash(), objectKey, dependencies)
+        || !cache.get(objectKey, data)) {
+        return false;
+    }
+
+    error() << "job" << mId << "served from direct cache" << mDirectKey;
+    if (wantsDeps && !depFile.write(dependencies)) {
+        mError = String::format("Unable to write dependency file %s", depFile.constData());
+        updateStatus(Error);
+        Job::finish(this);
+        return true;
+    }
+    writeFile(data);
+    if (mStatus != Error)
+        updateStatus(Compiled);
+    Job::finish(this);
+    return true;
+}
+
+bool Job::collectIncludes()
+{
+    // the line markers in the preprocessed output name every file
+    // that went into it, e.g. # 1 "/usr/include/stdio.h" 1 3 4
+    assert(isPreprocessed());
+    Set<String> files;
+    const char* ptr = mPreprocessed.constData();
+    const char* const end = ptr + mPreprocessed.size();
+    while (ptr < end) {
+        const char* eol = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+        if (!eol)
+            eol = end;
+        if (eol - ptr > 4 && ptr[0] == '#' && ptr[1] == ' ' && isdigit(ptr[2])) {
+            const char* quote = static_cast<const char*>(memchr(ptr, '"', eol - ptr));
+            if (quote) {
+                String file;
+                for (const char* c = quote + 1; c < eol && *c != '"'; ++c) {
+                    if (*c == '\\' && c + 1 < eol)
+                        ++c;
+                    file.append(*c);
+                }
+                if (!file.isEmpty() && file.at(0) != '<')
+                    files.insert(file);
+            }
+        }
+        ptr = eol + 1;
+    }
+
+    mIncludes.clear();
+    const Path cwd = mPath.ensureTrailingSlash();
+    for (const String& file : files) {
+        Path path = file;
+        if (!path.isAbsolute())
+            path = cwd + path;
+        // modified while we were building, the object might not match
+        if (!path.isFile() || path.lastModifiedMs() >= mStarted)
+            return false;
+        mIncludes[file] = Daemon::instance()->cache().hashFile(path);
     }
+    return true;
+}
+
+void Job::addToDirectCache()
+{
+    if (mDirectKey.isEmpty() || mCacheKey.isEmpty() || mIncludes.isEmpty())
+        return;
+    String dependencies;
+    const Path depFile = dependencyFile();
+    if (!depFile.isEmpty()) {
+        dependencies = depFile.readAll();
+        if (dependencies.isEmpty())
+            return;
+    }
+    Daemon::instance()->cache().insertDirect(mDirectKey, mIncludes, mCacheKey, dependencies);
+    mDirectKey.clear();
 }
 
 void Job::finish(Job* job)
@@ -109,6 +401,11 @@ String Job::readAllStdOut()
 {
     String ret;
     std::swap(ret, mStdOut);
+    if (!ret.isEmpty()) {
+        mHasDiagnostics = true;
+        if (mStatus == Compiling || mStatus == RemoteReceiving)
+            mCompileStdOut += ret;
+    }
     return ret;
 }
 
@@ -116,20 +413,32 @@ String Job::readAllStdErr()
 {
     String ret;
     std::swap(ret, mStdErr);
+    if (!ret.isEmpty()) {
+        mHasDiagnostics = true;
+        if (mStatus == Compiling || mStatus == RemoteReceiving)
+            mCompileStdErr += ret;
+    }
     return ret;
 }
 
-void Job::writeFile(const String& data)
+Path Job::outputFile() const
+{
+    const Path out = mCompilerArgs->output();
+    if (out.isEmpty() || out.isAbsolute())
+        return out;
+    return mPath.ensureTrailingSlash() + out;
+}
+
+void Job::writeFile(const String& data, bool append)
 {
     // see if we can open
-    Path out = mCompilerArgs->output();
+    const Path out = outputFile();
     if (out.isEmpty()) {
         mError = "Compiler output empty";
         updateStatus(Error);
         return;
     }
-    out = mPath.ensureTrailingSlash() + out;
-    FILE* file = fopen(out.constData(), "w");
+    FILE* file = fopen(out.constData(), append ? "a" : "w");
     if (!file) {
         mError = String::format("fopen failed: %d (%s)", errno, out.constData());
         updateStatus(Error);
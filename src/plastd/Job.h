@@ -2,8 +2,10 @@
 #define JOB_H
 
 #include "CompilerVersion.h"
+#include <Buffer.h>
 #include <rct/Hash.h>
 #include <rct/List.h>
+#include <rct/Map.h>
 #include <rct/Path.h>
 #include <rct/String.h>
 #include <rct/SignalSlot.h>
@@ -26,7 +28,7 @@ public:
 
     static SharedPtr create(const Path& path, const List<String>& args, Type type,
                             const String& remoteName, uint64_t remoteId = 0,
-                            const String& preprocessed = String(),
+                            const plast::Buffer& preprocessed = plast::Buffer(),
                             uint32_t serial = 0,
                             plast::CompilerType ctype = plast::Unknown,
                             int32_t cmajor = 0, const String& ctarget = String());
@@ -59,15 +61,29 @@ public:
 
     Status status() const { return mStatus; }
     bool isPreprocessed() const { return !mPreprocessed.isEmpty(); }
+    // remote job whose preprocessed data arrives in chunks
+    bool isStreamed() const { return mStreamed; }
+    // preprocessed by the peer from the sources and headers we sent
+    bool isPumped() const { return mPumped; }
     Path path() const { return mPath; }
     Path resolvedCompiler() const { return mResolvedCompiler; }
-    String preprocessed() const { return mPreprocessed; }
+    CompilerVersion::SharedPtr compilerVersion() const { return mCompilerVersion; }
+    const String& preprocessed() const { return mPreprocessed.string(); }
+    const plast::Buffer& preprocessedBuffer() const { return mPreprocessed; }
+    String preprocessedHash();
     void clearPreprocessed() { assert(!mPreprocessed.isEmpty()); mPreprocessed.clear(); }
     String &takeObjectCode() { return mObjectCode; }
     const String &objectCode() const { return mObjectCode; }
     List<String> args() const { return mArgs; }
     std::shared_ptr<CompilerArgs> compilerArgs() const { return mCompilerArgs; }
     Type type() const { return mType; }
+    Path outputFile() const;
+
+    bool isCacheable() const;
+    String cacheKey() const { return mCacheKey; }
+    // an identical job was built while this one waited, replays
+    // its compiler output and takes its object
+    void finishFromIdentical(const Job* identical, String&& objectCode);
 
     String readAllStdOut();
     String readAllStdErr();
@@ -87,12 +103,24 @@ public:
 
 private:
     Job(const Path& path, const List<String>& args, Type type, uint64_t remoteId,
-        const String& preprocessed, uint32_t serial, const String& remoteName,
+        const plast::Buffer& preprocessed, uint32_t serial, const String& remoteName,
         plast::CompilerType ctype, int32_t cmajor, const String& ctarget);
 
-    void writeFile(const String& data);
+    void writeFile(const String& data, bool append = false);
     void updateStatus(Status status);
 
+    void computeCacheKey();
+    bool findInCache(String& data);
+    bool startFromCache();
+    bool startPumped();
+    void stopPumping();
+    bool startFromDirectCache();
+    void finishFromCache(String&& data);
+    void addToCache(const String& objectCode);
+    void addToDirectCache();
+    bool collectIncludes();
+    Path dependencyFile() const;
+
     static void finish(Job* job);
 
 private:
@@ -102,9 +130,26 @@ private:
     List<String> mArgs;
     std::shared_ptr<CompilerArgs> mCompilerArgs;
     Path mPath, mResolvedCompiler;
+    CompilerVersion::SharedPtr mCompilerVersion;
     uint64_t mRemoteId;
-    String mPreprocessed, mObjectCode;
+    // shared with retries and outgoing messages
+    plast::Buffer mPreprocessed;
+    String mPreprocessedHash, mObjectCode;
+    String mCacheKey, mDirectKey;
+    Map<String, String> mIncludes;
+    uint64_t mStarted;
     String mStdOut, mStdErr;
+    // compiler output past preprocessing, replayed to coalesced jobs
+    String mCompileStdOut, mCompileStdErr;
+    bool mHasDiagnostics, mStreamed;
+    bool mPumped, mPumpFailed;
+    // the include closure on our side, the virtual include root on the peer
+    List<Path> mPumpFiles, mPumpSystemDirs;
+    Path mPumpRoot;
+    // a remote attempt's output, held back until it finishes so that a
+    // rescheduled job doesn't repeat itself and a pumped job that tripped
+    // over a missing header doesn't show the peer's errors
+    String mRemoteStdOut, mRemoteStdErr;
     Status mStatus;
     Type mType;
     uint32_t mSerial;
@@ -1,12 +1,15 @@
 #include "Local.h"
 #include "Daemon.h"
 #include "CompilerArgs.h"
+#include "MemFile.h"
 #include <Plast.h>
 #include <rct/Process.h>
 #include <rct/ThreadPool.h>
 #include <rct/Log.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 
 Local::Local(int overcommit)
     : mOvercommit(overcommit)
@@ -21,19 +24,28 @@ void Local::init()
 {
     mPool.setCount(Daemon::instance()->options().jobCount);
     mPool.readyReadStdOut().connect([this](ProcessPool::Id id, Process* proc) {
-            const Data& data = mJobs[id];
+            Data& data = mJobs[id];
             Job::SharedPtr job = data.job.lock();
             if (!job)
                 return;
+            if (data.hedge) {
+                // only shown if we win
+                data.stdOut += proc->readAllStdOut();
+                return;
+            }
             job->mStdOut += proc->readAllStdOut();
             job->mReadyReadStdOut(job.get());
         });
     mPool.readyReadStdErr().connect([this](ProcessPool::Id id, Process* proc) {
             assert(mJobs.contains(id));
-            const Data& data = mJobs[id];
+            Data& data = mJobs[id];
             Job::SharedPtr job = data.job.lock();
             if (!job)
                 return;
+            if (data.hedge) {
+                data.stdErr += proc->readAllStdErr();
+                return;
+            }
             job->mStdErr += proc->readAllStdErr();
             job->mReadyReadStdErr(job.get());
         });
@@ -43,9 +55,14 @@ void Local::init()
             assert(mJobs.contains(id));
             const Data& data = mJobs[id];
             Job::SharedPtr job = data.job.lock();
-            if (!job)
+            if (!job) {
+                // gone or abandoned while queued
+                mPool.kill(id);
                 return;
-            job->updateStatus(Job::Compiling);
+            }
+            // a hedged job stays RemotePending until one copy wins
+            if (!data.hedge)
+                job->updateStatus(Job::Compiling);
             if (data.posted) {
                 std::shared_ptr<Connection> scheduler = Daemon::instance()->remote().scheduler();
                 scheduler->send(BuildingMessage(job->remoteName(), job->compilerArgs()->sourceFile(),
@@ -58,7 +75,8 @@ void Local::init()
             const Data data = mJobs[id];
             const String fn = data.filename;
             Job::SharedPtr job = data.job.lock();
-            const bool localForRemote = !fn.isEmpty();
+            const bool localForRemote = !data.hedge && (!fn.isEmpty() || data.output);
+            mStreams.erase(data.jobid);
 
             if (data.posted) {
                 std::shared_ptr<Connection> scheduler = Daemon::instance()->remote().scheduler();
@@ -67,7 +85,7 @@ void Local::init()
 
             if (!job) {
                 error() << "job not found in finish";
-                if (localForRemote) {
+                if (!fn.isEmpty()) {
                     unlink(fn.constData());
                 }
                 return;
@@ -75,6 +93,21 @@ void Local::init()
             assert(job->id() == data.jobid);
 
             const int retcode = proc->returnCode();
+            if (data.hedge) {
+                if (retcode != 0 && Daemon::instance()->remote().hedgeFailed(job)) {
+                    unlink(fn.constData());
+                    return;
+                }
+                // we won, the peer's answer is dropped with the job
+                if (!data.stdOut.isEmpty()) {
+                    job->mStdOut += data.stdOut;
+                    job->mReadyReadStdOut(job.get());
+                }
+                if (!data.stdErr.isEmpty()) {
+                    job->mStdErr += data.stdErr;
+                    job->mReadyReadStdErr(job.get());
+                }
+            }
             if (retcode != 0) {
                 if (retcode < 0) {
                     // this is bad
@@ -85,22 +118,33 @@ void Local::init()
             } else {
                 if (localForRemote) {
                     // read all the compiled data
-                    FILE* f = fopen(fn.constData(), "r");
-                    assert(f);
-                    job->mObjectCode = Rct::readAll(f);
-                    fclose(f);
+                    if (data.output) {
+                        data.output->readAll(job->mObjectCode);
+                    } else {
+                        FILE* f = fopen(fn.constData(), "r");
+                        assert(f);
+                        job->mObjectCode = Rct::readAll(f);
+                        fclose(f);
+                    }
                     if (job->mObjectCode.isEmpty()) {
                         job->mError = "Got no object code for compile";
                         job->setExitCode(1); // ???
                         job->updateStatus(Job::Error);
                     } else {
+                        job->addToCache(job->mObjectCode);
                         job->updateStatus(Job::Compiled);
                     }
+                } else if (data.hedge && rename(fn.constData(), job->outputFile().constData()) == -1) {
+                    job->mError = "Unable to move hedged object into place";
+                    job->setExitCode(1);
+                    job->updateStatus(Job::Error);
                 } else {
+                    if (!job->cacheKey().isEmpty() && Daemon::instance()->cache().isEnabled())
+                        job->addToCache(job->outputFile().readAll());
                     job->updateStatus(Job::Compiled);
                 }
             }
-            if (localForRemote) {
+            if (!fn.isEmpty()) {
                 unlink(fn.constData());
             }
             Job::finish(job.get());
@@ -109,12 +153,12 @@ void Local::init()
             error() << "pool error for" << id;
             assert(mJobs.contains(id));
             const Data data = mJobs[id];
-            const bool localForRemote = !data.filename.isEmpty();
-            if (localForRemote) {
+            if (!data.filename.isEmpty()) {
                 unlink(data.filename.constData());
             }
 
             mJobs.erase(id);
+            mStreams.erase(data.jobid);
 
             if (data.posted) {
                 std::shared_ptr<Connection> scheduler = Daemon::instance()->remote().scheduler();
@@ -140,6 +184,136 @@ void Local::init()
         });
 }
 
+// compile from preprocessed data on stdin, writing to output. The
+// dependency file was written when the job was preprocessed.
+static bool preprocessedCommandLine(const std::shared_ptr<CompilerArgs>& args, const String& output, List<String>& cmdline,
+                                    const String& input = "-")
+{
+    // an explicit -x sets the language flag as well, it's replaced by
+    // the preprocessed one below
+    CompilerArgs::Flag f = static_cast<CompilerArgs::Flag>(args->flags & CompilerArgs::LanguageMask);
+    const String lang = CompilerArgs::languageName(f, true);
+    if (lang.isEmpty())
+        return false;
+
+    cmdline = args->commandLine;
+    // hack the command line input argument to - and send stuff to stdin
+    cmdline[args->sourceFileIndexes[0]] = input;
+
+    if (args->flags & CompilerArgs::HasDashO) {
+        cmdline[args->objectFileIndex] = output;
+    } else {
+        cmdline.push_back("-o");
+        cmdline.push_back(output);
+    }
+
+    int i = 0;
+    while (i < cmdline.size()) {
+        const String &arg = cmdline.at(i);
+        // error() << "considering" << i << arg;
+        if (arg == "-MF") {
+            cmdline.remove(i, 2);
+        } else if (arg == "-MT") {
+            cmdline.remove(i, 2);
+        } else if (arg == "-MMD") {
+            cmdline.removeAt(i);
+        } else if (arg == "-x") {
+            cmdline.remove(i, 2);
+        } else if (arg.startsWith("-I")) {
+            if (arg.size() == 2) {
+                cmdline.remove(i, 2);
+            } else {
+                cmdline.removeAt(i);
+            }
+        } else {
+            ++i;
+        }
+    }
+
+    cmdline.removeFirst();
+    cmdline.prepend(lang);
+    cmdline.prepend("-x");
+    return true;
+}
+
+// compile a remote job from and to memfds rather than stdin and a
+// temp file. clang writes its output next to the target and renames
+// it into place unless told not to, which it can't do in /proc
+static bool compilesInMemory(const Job::SharedPtr& job)
+{
+    if (job->isStreamed() || !MemFile::isSupported())
+        return false;
+    switch (job->compilerType()) {
+    case plast::GCC:
+        return true;
+    case plast::Clang:
+        return job->compilerMajor() >= 12;
+    default:
+        break;
+    }
+    return false;
+}
+
+// rewrite a pumped command line so that it only sees the include
+// root the sender's files were unpacked into
+static List<String> pumpCommandLine(const Job::SharedPtr& job, const String& output)
+{
+    std::shared_ptr<CompilerArgs> args = job->compilerArgs();
+    const Path& root = job->mPumpRoot;
+    auto remap = [&root](const String& path) -> String {
+        return path.startsWith('/') ? root + path : path;
+    };
+    static const char* pathArgs[] = { "-I", "-iquote", "-isystem", "-idirafter", "-include", "-imacros", 0 };
+
+    List<String> cmdline = args->commandLine;
+    const int source = args->sourceFileIndexes[0];
+    cmdline[source] = remap(cmdline.at(source));
+    if (args->flags & CompilerArgs::HasDashO) {
+        cmdline[args->objectFileIndex] = output;
+    } else {
+        cmdline.push_back("-o");
+        cmdline.push_back(output);
+    }
+
+    List<String> ret;
+    ret.reserve(cmdline.size() + job->mPumpSystemDirs.size() * 2 + 2);
+    for (int i=1; i<cmdline.size(); ++i) {
+        const String& arg = cmdline.at(i);
+        if (arg == "-MF" || arg == "-MT" || arg == "-MQ") {
+            ++i;
+            continue;
+        } else if (arg == "-MD" || arg == "-MMD") {
+            continue;
+        }
+        bool handled = false;
+        for (int p=0; pathArgs[p]; ++p) {
+            const String flag = pathArgs[p];
+            if (arg == flag && i + 1 < cmdline.size()) {
+                ret.append(arg);
+                ret.append(remap(cmdline.at(++i)));
+                handled = true;
+                break;
+            } else if (arg.size() > flag.size() && arg.startsWith(flag)) {
+                ret.append(flag + remap(arg.mid(flag.size())));
+                handled = true;
+                break;
+            }
+        }
+        if (!handled)
+            ret.append(arg);
+    }
+    // the sender's built in search path in its order, after the
+    // user's dirs like it was there. -idirafter would put them behind
+    // the sender's own -idirafter dirs and break #include_next
+    ret.append("-nostdinc");
+    for (const Path& dir : job->mPumpSystemDirs) {
+        ret.append("-isystem");
+        ret.append(root + dir);
+    }
+    ret.append("-fdebug-prefix-map=" + root + "=");
+    return ret;
+}
+
 void Local::post(const Job::SharedPtr& job)
 {
     job->destroyed().connect(std::bind(&Local::handleJobDestroyed, this, std::placeholders::_1));
@@ -159,9 +333,28 @@ void Local::post(const Job::SharedPtr& job)
     Data data(job, true);
 
     if (job->type() == Job::RemoteJob) {
-        assert(job->isPreprocessed());
+        assert(job->isPreprocessed() || job->isStreamed() || job->isPumped());
         assert(args->sourceFileIndexes.size() == 1);
 
+        if (!job->isPumped() && compilesInMemory(job)) {
+            data.input = MemFile::create("plast-preprocessed");
+            data.output = MemFile::create("plast-object");
+            if (data.input && data.output && data.input->write(job->preprocessed())
+                && preprocessedCommandLine(args, data.output->path(), cmdline, data.input->path())) {
+                if (job->compilerType() == plast::Clang)
+                    cmdline.append("-fno-temp-file");
+                warning() << "Compiler resolved to" << cmd << job->path() << cmdline << "in memory";
+                const ProcessPool::Id id = mPool.prepare(Path(), cmd, cmdline);
+                mJobs[id] = data;
+                mPool.post(id);
+                return;
+            }
+            // regular files and stdin it is
+            data.input.reset();
+            data.output.reset();
+            cmdline = args->commandLine;
+        }
+
         data.filename = "/tmp/plastXXXXXXcmp";
         const int fd = mkstemps(data.filename.data(), 3);
         if (fd == -1) {
@@ -172,66 +365,116 @@ void Local::post(const Job::SharedPtr& job)
         }
         close(fd);
 
-        String lang;
-        if (!(args->flags & CompilerArgs::HasDashX)) {
-            CompilerArgs::Flag f = static_cast<CompilerArgs::Flag>(args->flags & CompilerArgs::LanguageMask);
-            lang = CompilerArgs::languageName(f, true);
-            if (lang.isEmpty()) {
-                error() << "Unknown language" << args->sourceFile();
-                job->mError = "Unknown language for remote job " + args->sourceFile();
-                job->updateStatus(Job::Error);
-                return;
-            }
+        if (job->isPumped()) {
+            const List<String> pumped = pumpCommandLine(job, data.filename);
+            const Path cwd = job->mPumpRoot + job->path();
+            warning() << "Compiler resolved to" << cmd << cwd << pumped << data.filename;
+            const ProcessPool::Id id = mPool.prepare(cwd, cmd, pumped);
+            mJobs[id] = data;
+            mPool.post(id);
+            return;
         }
 
-        // hack the command line input argument to - and send stuff to stdin
-        cmdline[args->sourceFileIndexes[0]] = "-";
+        if (!preprocessedCommandLine(args, data.filename, cmdline)) {
+            error() << "Unknown language" << args->sourceFile();
+            job->mError = "Unknown language for remote job " + args->sourceFile();
+            job->updateStatus(Job::Error);
+            return;
+        }
+        warning() << "Compiler resolved to" << cmd << job->path() << cmdline << data.filename;
+        const ProcessPool::Id id = mPool.prepare(Path(), cmd, cmdline, List<String>(), job->preprocessedBuffer(),
+                                                 job->isStreamed());
+        mJobs[id] = data;
+        if (job->isStreamed())
+            mStreams[job->id()] = id;
+        mPool.post(id);
+    } else {
+        ProcessPool::Id id;
+        if (job->isPreprocessed() && args->sourceFileIndexes.size() == 1
+            && preprocessedCommandLine(args, job->outputFile(), cmdline)) {
+            // taken back from the remote queue, no need to preprocess again
+            warning() << "preprocessed remote job became local" << job->id();
+            warning() << "Compiler resolved to" << cmd << job->path() << cmdline;
+            id = mPool.prepare(job->path(), cmd, cmdline, List<String>(), job->preprocessedBuffer());
+        } else {
+            warning() << "Compiler resolved to" << cmd << job->path() << cmdline << data.filename;
+            cmdline = args->commandLine;
+            cmdline.removeFirst();
+            id = mPool.prepare(job->path(), cmd, cmdline);
+        }
+        if (job->isPreprocessed())
+            Daemon::instance()->remote().compilingLocally(job);
+        mJobs[id] = data;
+        mPool.post(id);
+    }
+}
+
+void Local::hedge(const Job::SharedPtr& job)
+{
+    assert(job->type() == Job::LocalJob && job->status() == Job::RemotePending);
+    job->destroyed().connect(std::bind(&Local::handleJobDestroyed, this, std::placeholders::_1));
+
+    std::shared_ptr<CompilerArgs> args = job->compilerArgs();
+    const Path cmd = job->resolvedCompiler();
+    Data data(job, true);
+    data.hedge = true;
+    // the peer's object may be arriving at the same time, ours is
+    // only moved into place if it finishes first
+    data.filename = job->outputFile() + ".plastXXXXXX";
+    const int fd = cmd.isEmpty() ? -1 : mkstemp(data.filename.data());
+    if (fd == -1) {
+        error() << "Unable to hedge job" << job->id() << errno;
+        Daemon::instance()->remote().hedgeFailed(job);
+        return;
+    }
+    close(fd);
 
+    List<String> cmdline;
+    plast::Buffer input;
+    if (job->isPreprocessed() && args->sourceFileIndexes.size() == 1
+        && preprocessedCommandLine(args, data.filename, cmdline)) {
+        // still needed if the peer wins, the buffer is shared
+        input = job->preprocessedBuffer();
+    } else {
+        cmdline = args->commandLine;
         if (args->flags & CompilerArgs::HasDashO) {
             cmdline[args->objectFileIndex] = data.filename;
         } else {
             cmdline.push_back("-o");
             cmdline.push_back(data.filename);
         }
+        cmdline.removeFirst();
+    }
+    warning() << "Compiler resolved to" << cmd << job->path() << cmdline << "hedging" << job->id();
+    const ProcessPool::Id id = mPool.prepare(job->path(), cmd, cmdline, List<String>(), input);
+    mJobs[id] = data;
+    mPool.post(id);
+}
 
-        int i = 0;
-        while (i < cmdline.size()) {
-            const String &arg = cmdline.at(i);
-            // error() << "considering" << i << arg;
-            if (arg == "-MF") {
-                cmdline.remove(i, 2);
-            } else if (arg == "-MT") {
-                cmdline.remove(i, 2);
-            } else if (arg == "-MMD") {
-                cmdline.removeAt(i);
-            } else if (arg.startsWith("-I")) {
-                if (arg.size() == 2) {
-                    cmdline.remove(i, 2);
-                } else {
-                    cmdline.removeAt(i);
-                }
-            } else {
-                ++i;
-            }
+void Local::abandon(const Job::SharedPtr& job)
+{
+    for (auto& it : mJobs) {
+        if (it.second.hedge && it.second.job.lock() == job) {
+            // finishes as if the job was gone
+            it.second.job.reset();
+            mPool.kill(it.first);
         }
+    }
+}
 
-        cmdline.removeFirst();
-        cmdline.prepend(lang);
-        cmdline.prepend("-x");
-        warning() << "Compiler resolved to" << cmd << job->path() << cmdline << data.filename;
-        const ProcessPool::Id id = mPool.prepare(Path(), cmd, cmdline, List<String>(), job->preprocessed());
-        mJobs[id] = data;
-        mPool.post(id);
-    } else {
-        if (job->isPreprocessed()) {
-            warning() << "preprocessed remote job became local" << job->id();
-            Daemon::instance()->remote().compilingLocally(job);
-        }
-        warning() << "Compiler resolved to" << cmd << job->path() << cmdline << data.filename;
-        cmdline.removeFirst();
-        const ProcessPool::Id id = mPool.prepare(job->path(), cmd, cmdline);
-        mJobs[id] = data;
-        mPool.post(id);
+void Local::write(const Job::SharedPtr& job, const String& data)
+{
+    auto it = mStreams.find(job->id());
+    if (it != mStreams.end())
+        mPool.write(it->second, data);
+}
+
+void Local::closeStdIn(const Job::SharedPtr& job)
+{
+    auto it = mStreams.find(job->id());
+    if (it != mStreams.end()) {
+        mPool.closeStdIn(it->second);
+        mStreams.erase(it);
     }
 }
 
@@ -285,7 +528,11 @@ void Local::takeRemoteJobs()
             break;
         }
         warning() << "took remote job";
-        post(job);
+        if (job->status() == Job::RemotePending) {
+            hedge(job);
+        } else {
+            post(job);
+        }
     }
     if (mPool.isIdle())
         Daemon::instance()->remote().requestMore();
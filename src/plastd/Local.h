@@ -4,6 +4,7 @@
 #include <rct/Hash.h>
 #include "ProcessPool.h"
 #include "Job.h"
+#include "MemFile.h"
 #include <cstdint>
 
 class Local
@@ -17,29 +18,48 @@ public:
     void post(const Job::SharedPtr& job);
     void run(const Job::SharedPtr& job);
 
+    // compile a job that is still out with a peer, see Remote::take()
+    void hedge(const Job::SharedPtr& job);
+    // the peer won, drop our copy
+    void abandon(const Job::SharedPtr& job);
+
+    // preprocessed data for a streamed remote job
+    void write(const Job::SharedPtr& job, const String& data);
+    void closeStdIn(const Job::SharedPtr& job);
+
     bool isAvailable() const { return mPool.isIdle() || mPool.pending() < mOvercommit; }
     uint32_t availableCount() const { return std::max<int>(mPool.max() - mPool.running() + mOvercommit, 0); }
+    int runningCount() const { return mPool.running(); }
+    int pendingCount() const { return mPool.pending(); }
 
-private:
     void takeRemoteJobs();
+
+private:
     void handleJobDestroyed(Job* job);
 
 private:
     ProcessPool mPool;
     struct Data
     {
-        Data() {}
+        Data() : posted(false), hedge(false) {}
         Data(const Job::SharedPtr& j, bool p)
-            : job(j), jobid(j->id()), remoteName(j->remoteName()), posted(p)
+            : job(j), jobid(j->id()), remoteName(j->remoteName()), posted(p), hedge(false)
         {
         }
 
         Job::WeakPtr job;
         uint64_t jobid;
         String filename, remoteName;
+        // remote job input and output, when not going through stdin and filename
+        MemFile::SharedPtr input, output;
         bool posted;
+        // a local copy of a job still out with a peer, compiled to
+        // filename with its output held back
+        bool hedge;
+        String stdOut, stdErr;
     };
     Hash<ProcessPool::Id, Data> mJobs;
+    Hash<uint64_t, ProcessPool::Id> mStreams;
     int mOvercommit;
 };
 
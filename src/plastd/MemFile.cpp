@@ -0,0 +1,89 @@
+#include "MemFile.h"
+#include <rct/Log.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
+
+MemFile::MemFile(int fd)
+    : mFd(fd), mPath(String::format<64>("/proc/%d/fd/%d", getpid(), fd))
+{
+}
+
+MemFile::~MemFile()
+{
+    close(mFd);
+}
+
+bool MemFile::isSupported()
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+    return true;
+#else
+    return false;
+#endif
+}
+
+MemFile::SharedPtr MemFile::create(const char* name)
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+    // the child opens it through /proc, it doesn't need to inherit it
+    const int fd = syscall(SYS_memfd_create, name, MFD_CLOEXEC);
+    if (fd == -1) {
+        error() << "Unable to create memfd" << errno;
+        return SharedPtr();
+    }
+    return SharedPtr(new MemFile(fd));
+#else
+    (void)name;
+    return SharedPtr();
+#endif
+}
+
+bool MemFile::write(const String& data)
+{
+    const char* ptr = data.constData();
+    size_t rem = data.size();
+    off_t off = 0;
+    while (rem) {
+        const ssize_t w = ::pwrite(mFd, ptr, rem, off);
+        if (w == -1) {
+            if (errno == EINTR)
+                continue;
+            error() << "Unable to write memfd" << errno;
+            return false;
+        }
+        ptr += w;
+        off += w;
+        rem -= w;
+    }
+    return true;
+}
+
+bool MemFile::readAll(String& data) const
+{
+    struct stat st;
+    if (fstat(mFd, &st) == -1)
+        return false;
+    // exactly sized, the object code is moved on from here
+    data.resize(st.st_size);
+    off_t off = 0;
+    while (off < st.st_size) {
+        const ssize_t r = ::pread(mFd, data.data() + off, st.st_size - off, off);
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        } else if (!r) {
+            data.resize(off);
+            break;
+        }
+        off += r;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef MEMFILE_H
+#define MEMFILE_H
+
+#include <rct/Path.h>
+#include <rct/String.h>
+#include <memory>
+
+// anonymous in-memory file that a compiler we spawn can open by path,
+// used to hand over input and collect output without touching disk
+class MemFile
+{
+public:
+    typedef std::shared_ptr<MemFile> SharedPtr;
+
+    ~MemFile();
+
+    // null if memfds aren't supported here
+    static SharedPtr create(const char* name);
+    static bool isSupported();
+
+    bool write(const String& data);
+    bool readAll(String& data) const;
+
+    // valid for any process running as our user, for as long as we live
+    Path path() const { return mPath; }
+
+private:
+    MemFile(int fd);
+
+    int mFd;
+    Path mPath;
+};
+
+#endif
@@ -3,17 +3,16 @@
 #include <Plast.h>
 #include <rct/Process.h>
 #include <assert.h>
-#include <unistd.h>
-#include <stdio.h>
 
 Preprocessor::Preprocessor()
+    : mSizeHint(0)
 {
     mPool.readyReadStdOut().connect([this](ProcessPool::Id id, Process* proc) {
-            Job::SharedPtr job = mJobs[id].job.lock();
-            if (!job)
-                return;
-            job->mStdOut += proc->readAllStdOut();
-            job->mReadyReadStdOut(job.get());
+            // the preprocessed output itself, diagnostics go to stderr
+            Data& data = mJobs[id];
+            if (data.output.isEmpty())
+                data.output.reserve(mSizeHint + mSizeHint / 4);
+            data.output += proc->readAllStdOut();
         });
     mPool.readyReadStdErr().connect([this](ProcessPool::Id id, Process* proc) {
             // throw stderr data away, mark job as having errors
@@ -38,19 +37,10 @@ Preprocessor::Preprocessor()
                     job->mError = "Preprocess failed";
                     job->updateStatus(Job::Error);
                 } else {
-                    // read all the preprocessed data
-                    char buf[65536];
-                    size_t r;
-                    FILE* f = fopen(data->second.filename.constData(), "r");
-                    assert(f);
-                    job->mPreprocessed.clear();
-                    while (!feof(f) && !ferror(f)) {
-                        r = fread(buf, 1, sizeof(buf), f);
-                        if (r) {
-                            job->mPreprocessed.append(buf, r);
-                        }
-                    }
-                    fclose(f);
+                    data->second.output += proc->readAllStdOut();
+                    const uint64_t size = data->second.output.size();
+                    mSizeHint = mSizeHint ? (mSizeHint * 7 + size) / 8 : size;
+                    job->mPreprocessed = std::move(data->second.output);
                     if (job->mPreprocessed.isEmpty()) {
                         job->mError = "Got no data from stdout for preprocess";
                         job->updateStatus(Job::Error);
@@ -59,13 +49,11 @@ Preprocessor::Preprocessor()
                     }
                 }
             }
-            unlink(data->second.filename.constData());
             mJobs.erase(data);
         });
     mPool.error().connect([this](ProcessPool::Id id) {
             Hash<ProcessPool::Id, Data>::iterator data = mJobs.find(id);
             assert(data != mJobs.end());
-            unlink(data->second.filename.constData());
             Job::SharedPtr job = data->second.job.lock();
             if (job) {
                 job->mError = "Unable to start job for preprocess";
@@ -82,29 +70,34 @@ Preprocessor::~Preprocessor()
 bool Preprocessor::preprocess(const Job::SharedPtr& job)
 {
     Data data(job);
-    data.filename = "/tmp/plastXXXXXXpre";
-    const int fd = mkstemps(data.filename.data(), 3);
-    if (fd == -1) {
-        // badness happened
-        job->mError = "Unable to mkstemps preprocess file";
-        job->updateStatus(Job::Error);
-        return false;
-    }
-    close(fd);
 
+    // preprocess to stdout, we collect it as it arrives
     std::shared_ptr<CompilerArgs> args = job->compilerArgs();
     List<String> cmdline = args->commandLine;
+    const String output = args->output();
     if (args->flags & CompilerArgs::HasDashO) {
-        cmdline[args->objectFileIndex] = data.filename;
+        cmdline[args->objectFileIndex] = "-";
     } else {
         cmdline.push_back("-o");
-        cmdline.push_back(data.filename);
+        cmdline.push_back("-");
+    }
+    // the compiler derives the dependency file and target from -o
+    if ((args->flags & CompilerArgs::HasDashMMD || cmdline.contains("-MD")) && !output.isEmpty()) {
+        if (!(args->flags & CompilerArgs::HasDashMF)) {
+            const int dot = output.lastIndexOf('.');
+            cmdline.push_back("-MF");
+            cmdline.push_back((dot > output.lastIndexOf('/') ? output.left(dot) : output) + ".d");
+        }
+        if (!(args->flags & CompilerArgs::HasDashMT) && !cmdline.contains("-MQ")) {
+            cmdline.push_back("-MT");
+            cmdline.push_back(output);
+        }
     }
     cmdline.push_back("-E");
     const Path compiler = job->resolvedCompiler();
     cmdline.removeFirst();
 
-    job->mPreprocessed.resize(1);
+    job->mPreprocessed = String(" ");
     const ProcessPool::Id id = mPool.prepare(job->path(), compiler, cmdline);
     mJobs[id] = data;
     mPool.post(id);
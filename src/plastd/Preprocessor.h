@@ -8,6 +8,7 @@
 #include <rct/String.h>
 #include "ProcessPool.h"
 #include "Job.h"
+#include <cstdint>
 
 class Preprocessor
 {
@@ -26,9 +27,11 @@ private:
         Data(const Job::SharedPtr& j) : job(j) {}
 
         Job::WeakPtr job;
-        String filename;
+        String output;
     };
     Hash<ProcessPool::Id, Data> mJobs;
+    // running average of preprocessed sizes, to avoid growing the buffer
+    uint64_t mSizeHint;
 };
 
 #endif
@@ -77,10 +77,16 @@ bool ProcessPool::runProcess(Process*& proc, Job& job, bool except)
     if (ok) {
         job.process = proc;
         ++mRunning;
-        if (!job.stdin.isEmpty()) {
-            proc->write(job.stdin);
+        const bool hasInput = !job.stdin.isEmpty() || !job.pendingStdIn.isEmpty();
+        if (!job.stdin.isEmpty())
+            proc->write(job.stdin.string());
+        if (!job.pendingStdIn.isEmpty())
+            proc->write(job.pendingStdIn);
+        // the rest comes through write() if kept open
+        job.stdin.clear();
+        job.pendingStdIn.clear();
+        if (!job.keepStdInOpen && hasInput)
             proc->closeStdIn();
-        }
         mStarted(job.id, proc);
     } else {
         job.process = 0;
@@ -89,10 +95,10 @@ bool ProcessPool::runProcess(Process*& proc, Job& job, bool except)
 }
 
 ProcessPool::Id ProcessPool::prepare(const Path& path, const Path &command, const List<String> &arguments,
-                                     const List<String> &environ, const String& stdin)
+                                     const List<String> &environ, const plast::Buffer& stdin, bool keepStdInOpen)
 {
     const Id id = ++mNextId;
-    Job job = { id, path, command, arguments, environ, stdin, 0 };
+    Job job = { id, path, command, arguments, environ, stdin, String(), keepStdInOpen, 0 };
     mPrepared[id] = job;
     return id;
 }
@@ -170,3 +176,43 @@ bool ProcessPool::kill(Id id, int sig)
     it->second.process->kill(sig);
     return true;
 }
+
+ProcessPool::Job* ProcessPool::find(Id id)
+{
+    auto it = mRunningJobs.find(id);
+    if (it != mRunningJobs.end())
+        return &it->second;
+    it = mPrepared.find(id);
+    if (it != mPrepared.end())
+        return &it->second;
+    for (Job& job : mPending) {
+        if (job.id == id)
+            return &job;
+    }
+    return 0;
+}
+
+void ProcessPool::write(Id id, const String& data)
+{
+    Job* job = find(id);
+    if (!job)
+        return;
+    if (job->process) {
+        job->process->write(data);
+    } else {
+        // not started yet
+        job->pendingStdIn += data;
+    }
+}
+
+void ProcessPool::closeStdIn(Id id)
+{
+    Job* job = find(id);
+    if (!job)
+        return;
+    if (job->process) {
+        job->process->closeStdIn();
+    } else {
+        job->keepStdInOpen = false;
+    }
+}
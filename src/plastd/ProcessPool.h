@@ -7,6 +7,7 @@
 #include <rct/String.h>
 #include <rct/Path.h>
 #include <rct/SignalSlot.h>
+#include <Buffer.h>
 #include <cstdint>
 #include <signal.h>
 
@@ -26,11 +27,16 @@ public:
                const Path& command,
                const List<String>& arguments = List<String>(),
                const List<String>& environ = List<String>(),
-               const String& stdin = String());
+               const plast::Buffer& stdin = plast::Buffer(),
+               bool keepStdInOpen = false);
     void post(Id id);
     void run(Id id);
     bool kill(Id id, int sig = SIGTERM);
 
+    // feed more stdin to a job prepared with keepStdInOpen
+    void write(Id id, const String& data);
+    void closeStdIn(Id id);
+
     Signal<std::function<void(Id, Process*)> >& started() { return mStarted; }
     Signal<std::function<void(Id, Process*)> >& readyReadStdOut() { return mReadyReadStdOut; }
     Signal<std::function<void(Id, Process*)> >& readyReadStdErr() { return mReadyReadStdErr; }
@@ -49,11 +55,16 @@ private:
         Id id;
         Path path, command;
         List<String> arguments, environ;
-        String stdin;
+        // shared with the job, not copied per queue hop
+        plast::Buffer stdin;
+        // written before the process started, goes after stdin
+        String pendingStdIn;
+        bool keepStdInOpen;
         Process* process;
     };
 
     bool runProcess(Process*& proc, Job& job, bool except);
+    Job* find(Id id);
 
 private:
     int mCount;
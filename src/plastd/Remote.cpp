@@ -1,13 +1,45 @@
 #include "Remote.h"
 #include "Daemon.h"
 #include "CompilerVersion.h"
+#include "IncludeScanner.h"
 #include <rct/EventLoop.h>
 #include <rct/Log.h>
+#include <rct/Sha256.h>
+#include <algorithm>
+#include <limits>
 #include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+// value at pct percent of the way through samples
+static inline int percentile(const List<int>& samples, int pct)
+{
+    assert(!samples.isEmpty());
+    List<int> sorted = samples;
+    auto nth = sorted.begin() + std::min<int>(sorted.size() * pct / 100, sorted.size() - 1);
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    return *nth;
+}
+
+static inline void addSample(List<int>& samples, int value, int max)
+{
+    samples.append(value);
+    if (samples.size() > max)
+        samples.removeFirst();
+}
+
+static inline uint32_t handshakeFlags()
+{
+    uint32_t flags = HandshakeMessage::HasChunkStore;
+    if (Daemon::instance()->cache().isEnabled())
+        flags |= HandshakeMessage::HasCache;
+    return flags;
+}
 
 Remote::Remote()
-    : mNextId(0), mRequestedCount(0), mRescheduleTimeout(-1), mReconnectTimeout(1000),
-      mMaxPreprocessPending(0), mCurPreprocessed(0), mConnectionError(false)
+    : mNextId(0), mRequestedCount(0), mCompileTime(0), mRescheduleTimeout(-1), mReconnectTimeout(1000),
+      mMaxPreprocessPending(0), mCurPreprocessed(0), mConnectionError(false), mLoadReported(0), mReportedCompilers(-1), mStatsReported(0), mPumpStoreSize(0)
 {
 }
 
@@ -35,6 +67,13 @@ void Remote::init()
     mRescheduleTimeout = opts.rescheduleTimeout;
     mMaxPreprocessPending = opts.maxPreprocessPending;
 
+    // pumped headers only stay valid for the connection they came in on
+    const Path includes = opts.cacheDirectory + "includes/";
+    for (const Path& file : includes.files(Path::File)) {
+        Path::rm(file);
+    }
+    includes.mkdir(Path::Recursive);
+
     if (!mServer.listen(opts.localPort)) {
         error() << "Unable to tcp listen";
         abort();
@@ -50,6 +89,9 @@ void Remote::init()
                 case HasJobsMessage::MessageId:
                     handleHasJobsMessage(std::static_pointer_cast<HasJobsMessage>(message), mConnection);
                     break;
+                case CacheRingMessage::MessageId:
+                    handleCacheRingMessage(std::static_pointer_cast<CacheRingMessage>(message));
+                    break;
                 default:
                     error("Unexpected message Remote::init: %d", message->messageId());
                     break;
@@ -81,6 +123,13 @@ void Remote::init()
                         hn.resize(strlen(hn.constData()));
                         mConnection->send(PeerMessage(hn, opts.localPort, opts.jobCount));
                     }
+                    mLoadReported = 0;
+                    mReportedCompilers = -1;
+                    mReportedStats.clear();
+                    mStatsReported = 0;
+                    reportCompilers();
+                    reportLoad();
+                    reportStats();
                 }));
         if (!mConnection->connectTcp(opts.serverHost, opts.serverPort)) {
             error() << "unable to reconnect, retrying in" << mReconnectTimeout << "ms";
@@ -96,55 +145,104 @@ void Remote::init()
         });
     connectToScheduler();
 
+    // the scheduler matches requesters with workers by these
+    mLoadTimer.timeout().connect([this](Timer*) {
+            reportCompilers();
+            reportLoad();
+            reportStats();
+        });
+    mLoadTimer.restart(LoadReportInterval);
+
+    mClusterTimer.timeout().connect([this](Timer*) {
+            const uint64_t now = Rct::monoMs();
+            List<Job::WeakPtr> expired;
+            auto it = mClusterFetches.begin();
+            while (it != mClusterFetches.end()) {
+                if (now - it->second.started >= ClusterFetchTimeout) {
+                    error() << "cluster cache fetch timed out" << it->first;
+                    expired << it->second.jobs;
+                    it = mClusterFetches.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (mClusterFetches.isEmpty())
+                mClusterTimer.stop();
+            for (const Job::WeakPtr& weak : expired) {
+                const Job::SharedPtr job = weak.lock();
+                if (job && job->status() == Job::Preprocessed)
+                    dispatchPreprocessed(job);
+            }
+        });
+
+    mInFlightTimer.timeout().connect([this](Timer*) {
+            const uint64_t now = Rct::monoMs();
+            List<Job::WeakPtr> expired;
+            for (auto& inflight : mInFlight) {
+                if (!inflight.second.waiters.isEmpty() && now - inflight.second.started >= InFlightTimeout) {
+                    error() << "identical job" << inflight.second.leader << "is taking too long for"
+                            << inflight.second.waiters.size() << "waiters";
+                    expired << inflight.second.waiters;
+                    inflight.second.waiters.clear();
+                }
+            }
+            releaseWaiters(expired);
+        });
+
     mRescheduleTimer.timeout().connect([this](Timer*) {
             //error() << "checking for reschedule!!!";
             const uint64_t now = Rct::monoMs();
             // reschedule outstanding jobs only, local will get to pending jobs eventually
 #warning Should we reschedule pending remote jobs?
-            bool done = false;
+            // timeouts differ per peer and job so everything is looked
+            // at, and we check again around when the next one is due
+            int next = Daemon::instance()->options().rescheduleCheck;
             auto it = mBuildingByTime.begin();
-            while (it != mBuildingByTime.end() && !done) {
-                bool del = false;
+            while (it != mBuildingByTime.end()) {
                 const uint64_t started = it->first;
                 auto building = it->second.begin();
                 while (building != it->second.end()) {
                     assert(mBuildingById.contains((*building)->jobid));
-                    const int timeout = mRescheduleTimeout * std::max<uint32_t>(1, (*building)->serial);
+                    Job::SharedPtr job = (*building)->job.lock();
+                    const int timeout = rescheduleTimeout(**building, now);
+                    int64_t remaining = timeout - static_cast<int64_t>(now - started);
+                    if (job && job->status() == Job::RemoteReceiving) {
+                        // only once it stops making progress
+                        remaining = std::max<int64_t>(remaining, stallTimeout(**building) - static_cast<int64_t>(now - (*building)->progress));
+                    }
                     warning() << "considering" << now << started << (now - started) << timeout;
-                    if (now - started < timeout) {
-                        done = true;
-                        break;
+                    if (remaining > 0) {
+                        next = std::min<int64_t>(next, remaining);
+                        ++building;
+                        continue;
                     }
                     error() << "job has expired" << (*building)->jobid;
                     // reschedule
-                    Job::SharedPtr job = (*building)->job.lock();
                     if (job) {
                         assert(job->id() == (*building)->jobid);
                         error() << "job still exists" << job->status() << job->id();
-                        if (job->status() != Job::RemotePending) {
-#warning should we reschedule jobs we have partially received in case the connection times out?
-                            // can only reschedule remotepending jobs
+                        if ((job->status() != Job::RemotePending && job->status() != Job::RemoteReceiving)
+                            || (*building)->hedged) {
+                            // hedged ones are already running here as well
                             ++building;
                             continue;
                         }
                         error() << "rescheduling" << job->id() << "now" << now << "started" << started;
-                        job->updateStatus(Job::Idle);
-                        job->increaseSerial();
-                        job->start();
+                        cancel(**building);
+                        restart(job);
                     }
                     error() << "removed job 1" << (*building)->jobid;
                     mBuildingById.erase((*building)->jobid);
                     building = it->second.erase(building);
-                    if (it->second.isEmpty()) {
-                        del = true;
-                        break;
-                    }
                 }
-                if (del)
+                if (it->second.isEmpty())
                     mBuildingByTime.erase(it++);
                 else
                     ++it;
             }
+            mRescheduleTimer.restart(std::max<int>(next, MinRescheduleCheck));
+            // jobs may have turned into stragglers while we sat idle
+            Daemon::instance()->local().takeRemoteJobs();
             if (!mPendingBuild.isEmpty()) {
                 //mConnection->send(HasJobsMessage(mPendingBuild.size(), Daemon::instance()->options().localPort));
                 for (const auto& p : mPendingBuild) {
@@ -158,12 +256,119 @@ void Remote::init()
 void Remote::handleJobMessage(const JobMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
 {
     error() << "handle job message!" << msg->id() << "serial" << msg->serial();
+    if (!resolve(conn, msg->compiler())) {
+        conn->finish();
+        return;
+    }
+    bool payloadReply = false;
+    {
+        auto requested = mPayloadRequested.find(conn);
+        if (requested != mPayloadRequested.end()) {
+            auto it = requested->second.find(msg->id());
+            if (it != requested->second.end() && it->second == msg->serial()) {
+                payloadReply = true;
+                requested->second.erase(it);
+                if (requested->second.isEmpty())
+                    mPayloadRequested.erase(requested);
+            }
+        }
+    }
+    if (hasCreditFlow(conn) && !payloadReply) {
+        const ConnectionKey ck = { conn, msg->compilerType(), msg->compilerMajor(), msg->compilerTarget() };
+        sampleRoundTrip(ck);
+        auto it = mRequested.find(ck);
+        if (it != mRequested.end()) {
+            --mRequestedCount;
+            if (!--it->second)
+                mRequested.erase(it);
+        }
+    }
+    plast::Buffer preprocessed;
+    const bool uncompressed = uncompress(msg->preprocessedBuffer(), msg->compression(), preprocessed);
+    if (msg->isChunked()) {
+        const plast::Buffer literal = preprocessed;
+        String data;
+        auto peer = mPeersByConn.find(conn);
+        if (peer != mPeersByConn.end() && !peer->second.chunksReceived)
+            peer->second.chunksReceived = std::make_shared<ChunkStore>(ChunkStore::Data, ChunkStoreSize);
+        if (!uncompressed || peer == mPeersByConn.end()
+            || !peer->second.chunksReceived->decode(msg->chunks(), msg->chunkSizes(), literal.string(), data)) {
+            // our chunk store no longer matches the mirror on the
+            // other side, start over on a new connection
+            error() << "unable to rebuild chunked job" << msg->id() << "from" << conn->client()->peerName();
+            conn->finish();
+            return;
+        }
+        preprocessed = std::move(data);
+    } else if (!uncompressed) {
+        send(conn, JobResponseMessage(JobResponseMessage::Error, 1, msg->id(), msg->serial(),
+                                      "Unable to uncompress preprocessed data"));
+        return;
+    }
     // let's make a job out of this
     Job::SharedPtr job = Job::create(msg->path(), msg->args(), Job::RemoteJob, msg->remoteName(),
-                                     msg->id(), msg->preprocessed(), msg->serial(),
+                                     msg->id(), preprocessed, msg->serial(),
                                      msg->compilerType(), msg->compilerMajor(), msg->compilerTarget());
+    if (msg->isPump()) {
+        Path root;
+        List<String> hashes;
+        const bool ok = preparePumpRoot(msg, root, hashes);
+        // removed with the job
+        job->mPumpRoot = root;
+        job->destroyed().connect([this, hashes](Job*) {
+                releasePumped(hashes);
+            });
+        if (!ok) {
+            send(conn, JobResponseMessage(JobResponseMessage::Error, 1, msg->id(), msg->serial(),
+                                          "Unable to set up pump include root"));
+            Job::finish(job.get());
+            return;
+        }
+        job->mPumped = true;
+        for (const String& dir : msg->systemDirs()) {
+            job->mPumpSystemDirs.append(dir);
+        }
+    } else if (msg->isStreamed()) {
+        // the compiler starts on the first chunk
+        job->mStreamed = true;
+        if (!msg->preprocessedHash().isEmpty()) {
+            job->mPreprocessedHash = msg->preprocessedHash();
+            job->computeCacheKey();
+        }
+        mStreams[conn][msg->id()] = job;
+    } else if (msg->preprocessed().isEmpty() && !msg->preprocessedHash().isEmpty()) {
+        // offered by hash, answer from our cache or ask for the payload
+        job->mPreprocessedHash = msg->preprocessedHash();
+        String data;
+        if (job->findInCache(data)) {
+            error() << "answering job offer from cache" << msg->id() << "serial" << msg->serial();
+            plast::Compression compression;
+            send(conn, JobResponseMessage(JobResponseMessage::Compiled, 0, msg->id(), msg->serial(),
+                                          compress(conn, data, compression), compression));
+        } else {
+            mPayloadRequested[conn][msg->id()] = msg->serial();
+            conn->send(RequestPayloadMessage(msg->id(), msg->serial()));
+        }
+        Job::finish(job.get());
+        return;
+    }
     std::weak_ptr<Connection> weakConn = conn;
-    job->statusChanged().connect([weakConn](Job* job, Job::Status status, Job::Status /*oldStatus*/) {
+    // so that the requester can cancel it
+    mRemoteJobs[conn][msg->id()] = job;
+    const uint64_t remoteId = msg->id();
+    job->destroyed().connect([this, weakConn, remoteId](Job*) {
+            const std::shared_ptr<Connection> conn = weakConn.lock();
+            auto jobs = mRemoteJobs.find(conn);
+            if (jobs == mRemoteJobs.end())
+                return;
+            // a newer attempt with the same id may have taken the slot
+            auto it = jobs->second.find(remoteId);
+            if (it != jobs->second.end() && it->second.expired())
+                jobs->second.erase(it);
+            if (jobs->second.isEmpty())
+                mRemoteJobs.erase(jobs);
+        });
+    job->statusChanged().connect([this, weakConn](Job* job, Job::Status status, Job::Status /*oldStatus*/) {
             const std::shared_ptr<Connection> conn = weakConn.lock();
             if (!conn) {
                 error() << "no connection" << __FILE__ << __LINE__;
@@ -171,40 +376,63 @@ void Remote::handleJobMessage(const JobMessage::SharedPtr& msg, const std::share
             }
             assert(job->type() == Job::RemoteJob);
             error() << "remote job status changed" << job << "local" << job->id() << "serial" << job->serial() << "remote" << job->remoteId() << status;
-#warning should tell remote side to abort the job if status == Aborted
+            // aborted jobs were cancelled by the requester or lost it,
+            // either way there is no one to tell
             switch (status) {
-            case Job::Compiled:
-                conn->send(JobResponseMessage(JobResponseMessage::Compiled, job->exitCode(),
-                                              job->remoteId(), job->serial(),
-                                              std::forward<String>(job->takeObjectCode())));
-                break;
+            case Job::Compiled: {
+                {
+                    const int took = Rct::currentTimeMs() - job->mStarted;
+                    mCompileTime = mCompileTime ? (mCompileTime * 7 + took) / 8 : took;
+                }
+                if (job->objectCode().size() > ChunkSize) {
+                    // the response without data marks the end of the object,
+                    // the output it had goes ahead of it
+                    flushResponses(conn);
+                    const int exitCode = job->exitCode();
+                    const uint64_t id = job->remoteId();
+                    const uint32_t serial = job->serial();
+                    sendChunks(conn, JobDataMessage::Object, id, serial,
+                               plast::Buffer(std::move(job->takeObjectCode())), [this, weakConn, exitCode, id, serial]() {
+                                   if (std::shared_ptr<Connection> conn = weakConn.lock())
+                                       send(conn, JobResponseMessage(JobResponseMessage::Compiled, exitCode, id, serial));
+                               });
+                    job->takeObjectCode().clear();
+                    break;
+                }
+                plast::Compression compression;
+                String data = compress(conn, std::move(job->takeObjectCode()), compression);
+                job->takeObjectCode().clear();
+                sendResponse(conn, std::make_shared<JobResponseMessage>(JobResponseMessage::Compiled, job->exitCode(),
+                                                                        job->remoteId(), job->serial(),
+                                                                        std::move(data), compression));
+                break; }
             case Job::Error:
-                conn->send(JobResponseMessage(JobResponseMessage::Error, job->exitCode(),
-                                              job->remoteId(), job->serial(), job->error()));
+                sendResponse(conn, std::make_shared<JobResponseMessage>(JobResponseMessage::Error, job->exitCode(),
+                                                                        job->remoteId(), job->serial(), job->error()));
                 break;
             default:
                 break;
             }
         });
-    job->readyReadStdOut().connect([weakConn](Job* job) {
+    job->readyReadStdOut().connect([this, weakConn](Job* job) {
             const std::shared_ptr<Connection> conn = weakConn.lock();
             if (!conn) {
                 error() << "no connection" << __FILE__ << __LINE__;
                 return;
             }
             warning() << "remote job ready stdout";
-            conn->send(JobResponseMessage(JobResponseMessage::Stdout, job->exitCode(),
-                                          job->remoteId(), job->serial(), job->readAllStdOut()));
+            sendResponse(conn, std::make_shared<JobResponseMessage>(JobResponseMessage::Stdout, job->exitCode(),
+                                                                    job->remoteId(), job->serial(), job->readAllStdOut()));
         });
-    job->readyReadStdErr().connect([weakConn](Job* job) {
+    job->readyReadStdErr().connect([this, weakConn](Job* job) {
             const std::shared_ptr<Connection> conn = weakConn.lock();
             if (!conn) {
                 error() << "no connection" << __FILE__ << __LINE__;
                 return;
             }
             warning() << "remote job ready stderr";
-            conn->send(JobResponseMessage(JobResponseMessage::Stderr, job->exitCode(),
-                                          job->remoteId(), job->serial(), job->readAllStdErr()));
+            sendResponse(conn, std::make_shared<JobResponseMessage>(JobResponseMessage::Stderr, job->exitCode(),
+                                                                    job->remoteId(), job->serial(), job->readAllStdErr()));
         });
     job->start();
 }
@@ -212,42 +440,576 @@ void Remote::handleJobMessage(const JobMessage::SharedPtr& msg, const std::share
 void Remote::handleRequestJobsMessage(const RequestJobsMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
 {
     error() << "handle request jobs message" << msg->count();
-    // take count jobs
-    const plast::CompilerKey k = { msg->compilerType(), msg->compilerMajor(), msg->compilerTarget() };
-    auto p = mPendingBuild.find(k);
-    if (p == mPendingBuild.end()) {
-        conn->send(LastJobMessage(k.type, k.major, k.target, 0, false));
+    if (!resolve(conn, msg->compiler())) {
+        conn->finish();
         return;
     }
-    auto& pending = p->second;
-    assert(!pending.isEmpty());
+    const ConnectionKey ck = { conn, msg->compilerType(), msg->compilerMajor(), msg->compilerTarget() };
+    pushJobs(ck, conn, msg->count());
+}
 
-    int rem = msg->count();
-    for (;;) {
-        Job::SharedPtr job = pending.front().lock();
-        pending.removeFirst();
-        if (job) {
-            // add job to building map
-            std::shared_ptr<Building> b = std::make_shared<Building>(Rct::monoMs(), job->id(), job->serial(), job, conn);
-            mBuildingByTime[b->started].append(b);
-            mBuildingById[b->jobid] = b;
-
-            assert(job->isPreprocessed());
-            // send this job to remote;
-            error() << "sending job back" << job->id() << "serial" << job->serial();
-            job->updateStatus(Job::RemotePending);
-            conn->send(JobMessage(job->path(), job->args(), job->id(), job->preprocessed(),
-                                  job->serial(), job->remoteName(), job->compilerType(),
-                                  job->compilerMajor(), job->compilerTarget()));
-            if (!--rem)
-                break;
+void Remote::pushJobs(const ConnectionKey& ck, const std::shared_ptr<Connection>& conn, int credit)
+{
+    const plast::CompilerKey k = { ck.type, ck.major, ck.target };
+
+    uint32_t peerFlags = HandshakeMessage::None, features = 0;
+    {
+        auto peer = mPeersByConn.find(conn);
+        if (peer != mPeersByConn.end()) {
+            peerFlags = peer->second.flags;
+            features = peer->second.features;
         }
-        if (pending.empty())
-            break;
     }
-    conn->send(LastJobMessage(k.type, k.major, k.target, msg->count() - rem, !pending.empty()));
-    if (pending.empty())
+    // peers with a result cache get the hash first
+    const bool withPayload = !(peerFlags & HandshakeMessage::HasCache);
+
+    // small jobs go together, as many as fit in BatchSize
+    JobBatchMessage::SharedPtr batch;
+    int batchSize = 0;
+    auto flush = [&]() {
+        if (!batch)
+            return;
+        std::shared_ptr<Message> msg = batch;
+        if (batch->jobs().size() == 1)
+            msg = batch->jobs().first();
+        if (withPayload) {
+            sendBulk(conn, JobDataMessage::Payload, msg);
+        } else {
+            send(conn, *msg);
+        }
+        batch.reset();
+        batchSize = 0;
+    };
+
+    int sent = 0;
+    auto p = mPendingBuild.find(k);
+    while (p != mPendingBuild.end() && !p->second.isEmpty() && credit > 0) {
+        Job::SharedPtr job = p->second.front().lock();
+        p->second.removeFirst();
+        if (!job)
+            continue;
+        // add job to building map
+        std::shared_ptr<Building> b = std::make_shared<Building>(Rct::monoMs(), job->id(), job->serial(), job, conn);
+        b->size = job->preprocessed().size();
+        mBuildingByTime[b->started].append(b);
+        mBuildingById[b->jobid] = b;
+
+        assert(job->isPreprocessed() || job->isPumped());
+        // send this job to remote;
+        error() << "sending job back" << job->id() << "serial" << job->serial();
+        job->updateStatus(Job::RemotePending);
+        if (!(features & plast::BatchedJobs) || job->isPumped()) {
+            sendJob(job, conn, withPayload);
+        } else {
+            const JobMessage::SharedPtr msg = jobMessage(job, conn, withPayload);
+            const int size = msg ? msg->preprocessed().size() : 0;
+            if (!msg || size > MaxBatchedJob) {
+                // behind the batch, chunked payloads have to stay in order
+                flush();
+                sendJob(job, conn, msg, withPayload);
+            } else {
+                if (batch && (batchSize + size > BatchSize || batch->jobs().size() >= MaxBatchJobs))
+                    flush();
+                if (!batch)
+                    batch = std::make_shared<JobBatchMessage>();
+                batch->append(msg);
+                batchSize += size;
+            }
+        }
+        --credit;
+        ++sent;
+    }
+    flush();
+    const bool hasMore = p != mPendingBuild.end() && !p->second.isEmpty();
+    if (p != mPendingBuild.end() && !hasMore)
         mPendingBuild.erase(p);
+
+    if (!hasCreditFlow(conn)) {
+        // one round per request, the peer asks again after this
+        send(conn, LastJobMessage(k.type, k.major, k.target, sent, hasMore));
+    } else if (!hasMore) {
+        // hand back what we have no use for, parked credit would
+        // keep the peer from taking work from anyone else
+        send(conn, LastJobMessage(k.type, k.major, k.target, credit, false));
+    } else {
+        // out of credit, the peer tops us up as its jobs finish
+        send(conn, LastJobMessage(k.type, k.major, k.target, 0, true));
+    }
+}
+
+void Remote::sendJob(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn, bool withPayload)
+{
+    if (job->isPumped()) {
+        sendPumped(job, conn);
+    } else {
+        sendJob(job, conn, jobMessage(job, conn, withPayload), withPayload);
+    }
+}
+
+void Remote::sendJob(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn,
+                     const JobMessage::SharedPtr& msg, bool withPayload)
+{
+    if (!msg) {
+        // let the peer start compiling before it has everything
+        send(conn, JobMessage(job->path(), job->args(), job->id(), String(),
+                              job->serial(), job->remoteName(), job->compilerType(),
+                              job->compilerMajor(), job->compilerTarget(),
+                              job->cacheKey().isEmpty() ? String() : job->preprocessedHash(),
+                              plast::NoCompression, JobMessage::Streamed));
+        sendChunks(conn, JobDataMessage::Payload, job->id(), job->serial(), job->preprocessedBuffer());
+    } else if (withPayload) {
+        sendBulk(conn, JobDataMessage::Payload, msg);
+    } else {
+        send(conn, *msg);
+    }
+}
+
+JobMessage::SharedPtr Remote::jobMessage(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn, bool withPayload)
+{
+    assert(!job->isPumped());
+    if (!withPayload) {
+        return std::make_shared<JobMessage>(job->path(), job->args(), job->id(), String(),
+                                            job->serial(), job->remoteName(), job->compilerType(),
+                                            job->compilerMajor(), job->compilerTarget(), job->preprocessedHash());
+    }
+    // streamed instead, so the peer can start compiling early. these
+    // stay out of the chunk stores on both sides
+    if (job->preprocessed().size() > ChunkSize)
+        return JobMessage::SharedPtr();
+    // only what the peer didn't have already
+    if (JobMessage::SharedPtr msg = chunkedJobMessage(job, conn))
+        return msg;
+    plast::Compression compression;
+    plast::Buffer preprocessed = job->preprocessedBuffer();
+    String compressed;
+    if (compress(conn, preprocessed.string(), compression, compressed))
+        preprocessed = std::move(compressed);
+    return std::make_shared<JobMessage>(job->path(), job->args(), job->id(), preprocessed,
+                                        job->serial(), job->remoteName(), job->compilerType(),
+                                        job->compilerMajor(), job->compilerTarget(), String(), compression);
+}
+
+void Remote::sendPumped(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn)
+{
+    auto peer = mPeersByConn.find(conn);
+    List<String> files, hashes, systemDirs;
+    Map<String, String> contents;
+    for (const Path& file : job->mPumpFiles) {
+        const String hash = IncludeScanner::hash(file);
+        if (hash.isEmpty())
+            continue;
+        files.append(file);
+        hashes.append(hash);
+        // the peer keeps what it got on this connection
+        if (peer == mPeersByConn.end() || !peer->second.pumpSent.contains(hash)) {
+            const String data = file.readAll();
+            contents[hash] = data;
+            mTransferStats.sent += data.size();
+            mTransferStats.sentWire += data.size();
+            if (peer != mPeersByConn.end())
+                peer->second.pumpSent.insert(hash);
+        }
+    }
+    for (const Path& dir : job->mPumpSystemDirs) {
+        systemDirs.append(dir);
+    }
+    warning() << "pumping job" << job->id() << "with" << files.size() << "files," << contents.size() << "new";
+
+    auto msg = std::make_shared<JobMessage>(job->path(), job->args(), job->id(), String(),
+                                            job->serial(), job->remoteName(), job->compilerType(),
+                                            job->compilerMajor(), job->compilerTarget());
+    msg->setPump(files, hashes, contents, systemDirs);
+    sendBulk(conn, JobDataMessage::Payload, msg);
+}
+
+// the name we store a pumped header under, a sha256 in hex
+static inline bool isPumpHash(const String& hash)
+{
+    if (hash.size() != 64)
+        return false;
+    for (int i=0; i<hash.size(); ++i) {
+        const char c = hash.at(i);
+        if (!isdigit(c) && (c < 'a' || c > 'f'))
+            return false;
+    }
+    return true;
+}
+
+// absolute, and nothing that leads out of the pump root once joined
+static inline bool isPumpPath(const String& path)
+{
+    if (!path.startsWith('/') || path.indexOf('\0') != -1)
+        return false;
+    for (const String& component : path.split('/')) {
+        if (component == "..")
+            return false;
+    }
+    return true;
+}
+
+bool Remote::preparePumpRoot(const JobMessage::SharedPtr& msg, Path& root, List<String>& hashes)
+{
+    const Path store = Daemon::instance()->options().cacheDirectory + "includes/";
+    for (const auto& content : msg->fileContents()) {
+        if (!isPumpHash(content.first) || Sha256::hash(content.second, Sha256::Hex) != content.first) {
+            error() << "pumped file doesn't match its hash" << content.first;
+            return false;
+        }
+        mTransferStats.received += content.second.size();
+        mTransferStats.receivedWire += content.second.size();
+        if (mPumpStore.contains(content.first))
+            continue;
+        const Path file = store + content.first;
+        if (!file.write(content.second)) {
+            error() << "Unable to write" << file;
+            return false;
+        }
+        mPumpLru.push_back(content.first);
+        mPumpStore[content.first] = { static_cast<int64_t>(content.second.size()), 0, --mPumpLru.end() };
+        mPumpStoreSize += content.second.size();
+    }
+
+    // mirror the sender's paths so that quoted includes relative to
+    // the including file still resolve
+    const List<String> files = msg->fileHashes();
+    const List<String> paths = msg->files();
+    if (files.size() != paths.size() || !isPumpPath(msg->path()))
+        return false;
+    for (const String& path : paths) {
+        if (!isPumpPath(path)) {
+            error() << "invalid pumped path" << path;
+            return false;
+        }
+    }
+
+    String dir = "/tmp/plastpumpXXXXXX";
+    if (!mkdtemp(dir.data())) {
+        error() << "Unable to mkdtemp pump root" << errno;
+        return false;
+    }
+    root = dir;
+
+    bool ok = true;
+    for (int i=0; i<paths.size(); ++i) {
+        auto entry = mPumpStore.find(files.at(i));
+        if (entry == mPumpStore.end()) {
+            // evicted, or never sent
+            error() << "pumped file missing from store" << paths.at(i) << files.at(i);
+            ok = false;
+            break;
+        }
+        // in use until the job goes away
+        ++entry->second.users;
+        mPumpLru.splice(mPumpLru.end(), mPumpLru, entry->second.lru);
+        hashes.append(files.at(i));
+
+        const Path stored = store + files.at(i);
+        const Path link = root + paths.at(i);
+        link.parentDir().mkdir(Path::Recursive);
+        if (symlink(stored.constData(), link.constData()) == -1 && errno != EEXIST) {
+            error() << "Unable to symlink" << link << errno;
+            ok = false;
+            break;
+        }
+    }
+    if (ok)
+        Path(root + msg->path()).mkdir(Path::Recursive);
+    evictPumped();
+    return ok;
+}
+
+void Remote::releasePumped(const List<String>& hashes)
+{
+    for (const String& hash : hashes) {
+        auto entry = mPumpStore.find(hash);
+        if (entry != mPumpStore.end()) {
+            assert(entry->second.users > 0);
+            --entry->second.users;
+        }
+    }
+    evictPumped();
+}
+
+void Remote::evictPumped()
+{
+    const Path store = Daemon::instance()->options().cacheDirectory + "includes/";
+    auto it = mPumpLru.begin();
+    while (mPumpStoreSize > MaxPumpStoreSize && it != mPumpLru.end()) {
+        auto entry = mPumpStore.find(*it);
+        assert(entry != mPumpStore.end());
+        if (entry->second.users) {
+            ++it;
+            continue;
+        }
+        Path::rm(store + *it);
+        mPumpStoreSize -= entry->second.size;
+        mPumpStore.erase(entry);
+        it = mPumpLru.erase(it);
+    }
+}
+
+JobMessage::SharedPtr Remote::chunkedJobMessage(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn)
+{
+    auto peer = mPeersByConn.find(conn);
+    if (peer == mPeersByConn.end() || !(peer->second.flags & HandshakeMessage::HasChunkStore))
+        return JobMessage::SharedPtr();
+    if (!peer->second.chunksSent)
+        peer->second.chunksSent = std::make_shared<ChunkStore>(ChunkStore::Mirror, ChunkStoreSize);
+
+    List<String> hashes;
+    List<uint32_t> sizes;
+    String literal;
+    const String& preprocessed = job->preprocessed();
+    peer->second.chunksSent->encode(preprocessed, hashes, sizes, literal);
+    mTransferStats.deduplicated += preprocessed.size() - literal.size();
+    warning() << "sending" << literal.size() << "of" << preprocessed.size() << "preprocessed bytes in"
+              << hashes.size() << "chunks, total deduplicated" << mTransferStats.deduplicated;
+
+    plast::Compression compression;
+    // has to be queued in order with other payloads, the peer's store
+    // has to see them in the order our mirror did
+    auto msg = std::make_shared<JobMessage>(job->path(), job->args(), job->id(), compress(conn, literal, compression),
+                                            job->serial(), job->remoteName(), job->compilerType(),
+                                            job->compilerMajor(), job->compilerTarget(), String(), compression);
+    msg->setChunks(hashes, sizes);
+    return msg;
+}
+
+void Remote::sendChunks(const std::shared_ptr<Connection>& conn, JobDataMessage::Type type,
+                        uint64_t id, uint32_t serial, const plast::Buffer& data,
+                        std::function<void()>&& done)
+{
+    OutgoingQueue& queue = mOutgoing[conn];
+    (type == JobDataMessage::Object ? queue.objects : queue.payloads).push_back({ type, id, serial, data, 0, std::move(done) });
+    sendMore(conn);
+}
+
+void Remote::sendBulk(const std::shared_ptr<Connection>& conn, JobDataMessage::Type type,
+                      const std::shared_ptr<Message>& msg)
+{
+    std::weak_ptr<Connection> weakConn = conn;
+    sendChunks(conn, type, 0, 0, plast::Buffer(), [this, weakConn, msg]() {
+            if (std::shared_ptr<Connection> conn = weakConn.lock())
+                send(conn, *msg);
+        });
+}
+
+void Remote::sendMore(const std::shared_ptr<Connection>& conn)
+{
+    // only a window's worth is serialized into the connection at a
+    // time, the rest stays in the shared buffer until the socket drains
+    auto outgoing = mOutgoing.find(conn);
+    while (outgoing != mOutgoing.end() && conn->pendingWrite() < SendWindow) {
+        OutgoingQueue& queues = outgoing->second;
+        LinkedList<Outgoing>& queue = !queues.objects.empty() ? queues.objects : queues.payloads;
+        if (queue.empty())
+            break;
+        Outgoing& out = queue.front();
+        const size_t size = out.data.size();
+        const bool last = out.offset + ChunkSize >= size;
+        if (size) {
+            const size_t length = std::min<size_t>(ChunkSize, size - out.offset);
+            plast::Compression compression;
+            String chunk;
+            if (compress(conn, out.data.constData() + out.offset, length, compression, chunk)) {
+                send(conn, JobDataMessage(out.type, out.id, out.serial, std::move(chunk), compression, last));
+            } else {
+                send(conn, JobDataMessage(out.type, out.id, out.serial, out.data, out.offset, length, last));
+            }
+            out.offset += ChunkSize;
+        }
+        if (last) {
+            const std::function<void()> done = std::move(out.done);
+            queue.pop_front();
+            if (done) {
+                done();
+                // sending may have taken the connection down
+                outgoing = mOutgoing.find(conn);
+            }
+        } else {
+            // next job's turn
+            queue.splice(queue.end(), queue, queue.begin());
+        }
+    }
+    if (outgoing == mOutgoing.end())
+        return;
+    // otherwise the connection is a window behind and lets us know
+    // when it has written it
+    if (outgoing->second.objects.empty() && outgoing->second.payloads.empty())
+        mOutgoing.erase(outgoing);
+}
+
+void Remote::handleJobDataMessage(const JobDataMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+{
+    if (msg->type() == JobDataMessage::Payload) {
+        auto streams = mStreams.find(conn);
+        if (streams == mStreams.end())
+            return;
+        auto stream = streams->second.find(msg->id());
+        if (stream == streams->second.end()) {
+            error() << "no stream for job" << msg->id();
+            return;
+        }
+        const Job::SharedPtr job = stream->second.lock();
+        if (!job || job->serial() != msg->serial()) {
+            streams->second.erase(stream);
+            return;
+        }
+        if (msg->isLast())
+            streams->second.erase(stream);
+        if (streams->second.isEmpty())
+            mStreams.erase(streams);
+
+        String data;
+        Local& local = Daemon::instance()->local();
+        if (!uncompress(msg->data(), msg->compression(), data)) {
+            job->mError = "Unable to uncompress preprocessed data";
+            job->updateStatus(Job::Error);
+            Job::finish(job.get());
+            return;
+        }
+        local.write(job, data);
+        if (msg->isLast())
+            local.closeStdIn(job);
+        return;
+    }
+
+    Job::SharedPtr job = Job::job(msg->id());
+    if (!job || job->serial() != msg->serial())
+        return;
+    auto building = mBuildingById.find(job->id());
+    if (building == mBuildingById.end() || !startReceiving(job))
+        return;
+    building->second->progress = Rct::monoMs();
+    String data;
+    if (!uncompress(msg->data(), msg->compression(), data)) {
+        job->mError = "Unable to uncompress object code";
+    } else {
+        // written as it arrives, the final response only confirms it
+        job->writeFile(data, building->second->received > 0);
+        building->second->received += data.size();
+        if (job->status() != Job::Error)
+            return;
+    }
+    removeJob(job->id());
+    if (job->status() != Job::Error)
+        job->updateStatus(Job::Error);
+    Job::finish(job.get());
+}
+
+bool Remote::startReceiving(const Job::SharedPtr& job)
+{
+    switch (job->status()) {
+    case Job::RemotePending: {
+        auto building = mBuildingById.find(job->id());
+        if (building != mBuildingById.end()) {
+            // first answer for this job
+            auto peer = mPeersByConn.find(building->second->conn.lock());
+            if (peer != mPeersByConn.end())
+                addSample(peer->second.latencies, Rct::monoMs() - building->second->started, PeerSamples);
+        }
+        if (building != mBuildingById.end() && building->second->hedged) {
+            // the peer beat our local copy
+            error() << "peer won hedged job" << job->id();
+            building->second->hedged = false;
+            Daemon::instance()->local().abandon(job);
+        }
+        job->updateStatus(Job::RemoteReceiving);
+        if (job->isPreprocessed()) {
+            assert(mCurPreprocessed > 0);
+            --mCurPreprocessed;
+            job->clearPreprocessed();
+            preprocessMore();
+        }
+        return true; }
+    case Job::RemoteReceiving:
+        return true;
+    default:
+        error() << "job no longer remote compiling";
+        assert(!mBuildingById.contains(job->id()));
+        return false;
+    }
+}
+
+void Remote::handleRequestPayloadMessage(const RequestPayloadMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+{
+    error() << "handle request payload" << msg->id() << "serial" << msg->serial();
+    Job::SharedPtr job = Job::job(msg->id());
+    if (!job || job->serial() != msg->serial() || job->status() != Job::RemotePending) {
+        error() << "payload requested for job no longer pending" << msg->id();
+        return;
+    }
+    auto building = mBuildingById.find(job->id());
+    if (building == mBuildingById.end() || building->second->conn.lock() != conn) {
+        error() << "payload requested by the wrong peer" << msg->id();
+        return;
+    }
+    assert(job->isPreprocessed());
+    sendJob(job, conn, true);
+}
+
+void Remote::handleJobBatchMessage(const JobBatchMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+{
+    error() << "handle job batch" << msg->jobs().size();
+    for (const JobMessage::SharedPtr& job : msg->jobs()) {
+        handleJobMessage(job, conn);
+    }
+}
+
+void Remote::sendResponse(const std::shared_ptr<Connection>& conn, const JobResponseMessage::SharedPtr& response)
+{
+    auto peer = mPeersByConn.find(conn);
+    if (peer == mPeersByConn.end() || !(peer->second.features & plast::BatchedJobs)) {
+        if ((response->mode() == JobResponseMessage::Compiled && !response->buffer().isEmpty())
+            || hasQueuedResponses(conn)) {
+            sendBulk(conn, JobDataMessage::Object, response);
+        } else {
+            send(conn, *response);
+        }
+        return;
+    }
+    // held until we get back to the event loop so responses from
+    // jobs finishing together go as one message
+    PendingResponses& pending = mResponses[conn];
+    if (pending.responses.isEmpty()) {
+        std::weak_ptr<Connection> weakConn = conn;
+        EventLoop::eventLoop()->callLater([this, weakConn]() {
+                if (std::shared_ptr<Connection> conn = weakConn.lock())
+                    flushResponses(conn);
+            });
+    }
+    pending.responses.append(response);
+    pending.size += response->buffer().size();
+    if (response->mode() == JobResponseMessage::Compiled && !response->buffer().isEmpty())
+        pending.hasObject = true;
+    if (pending.size >= BatchSize || pending.responses.size() >= MaxBatchJobs)
+        flushResponses(conn);
+}
+
+void Remote::flushResponses(const std::shared_ptr<Connection>& conn)
+{
+    auto pending = mResponses.find(conn);
+    if (pending == mResponses.end())
+        return;
+    std::shared_ptr<Message> msg;
+    if (pending->second.responses.size() == 1) {
+        msg = pending->second.responses.first();
+    } else {
+        msg = std::make_shared<JobResponseBatchMessage>(pending->second.responses);
+    }
+    const bool hasObject = pending->second.hasObject;
+    mResponses.erase(pending);
+    if (hasObject || hasQueuedResponses(conn)) {
+        sendBulk(conn, JobDataMessage::Object, msg);
+    } else {
+        send(conn, *msg);
+    }
+}
+
+bool Remote::hasQueuedResponses(const std::shared_ptr<Connection>& conn) const
+{
+    auto outgoing = mOutgoing.find(conn);
+    return outgoing != mOutgoing.end() && !outgoing->second.objects.empty();
 }
 
 void Remote::handleHasJobsMessage(const HasJobsMessage::SharedPtr& msg, const std::shared_ptr<Connection>& /*conn*/)
@@ -261,49 +1023,220 @@ void Remote::handleHasJobsMessage(const HasJobsMessage::SharedPtr& msg, const st
     }
     error() << "we have compiler" << msg->compilerType() << msg->compilerMajor() << msg->compilerTarget();
 
-    std::shared_ptr<Connection> remoteConn;
-    {
-        const Peer key = { msg->peer(), msg->port() };
-        auto peer = mPeersByKey.find(key);
-        if (peer == mPeersByKey.end()) {
-            // make connection
-            SocketClient::SharedPtr client = std::make_shared<SocketClient>();
-            client->connect(key.peer, key.port);
-            std::shared_ptr<Connection> conn = addClient(client);
-
-            mPeersByKey[key] = conn;
-            mPeersByConn[conn] = key;
-            remoteConn = conn;
-
-            conn->send(HandshakeMessage(Daemon::instance()->options().localPort));
-        } else {
-            remoteConn = peer->second.lock();
-        }
-    }
-
+    std::shared_ptr<Connection> remoteConn = connectToPeer(msg->peer(), msg->port());
     assert(remoteConn);
 
     const ConnectionKey ck = { remoteConn, msg->compilerType(), msg->compilerMajor(), msg->compilerTarget() };
+    if (msg->count() > 0) {
+        mShares[ck] = msg->count();
+    } else {
+        mShares.erase(ck);
+    }
     if (mRequested.contains(ck)) {
         error() << "already asked";
         // we already asked this host for jobs, wait until it gets back to us
         return;
     }
-
-    requestMore(ck);
+
+    mHasMore.insert(ck);
+    requestMore(ck);
+}
+
+static inline uint32_t memoryUsed()
+{
+    // MemAvailable counts reclaimable cache as free, MemFree doesn't
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (!f)
+        return 0;
+    unsigned long long total = 0, available = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "MemTotal: %llu", &total);
+        sscanf(line, "MemAvailable: %llu", &available);
+    }
+    fclose(f);
+    if (!total || available > total)
+        return 0;
+    return (total - available) * 100 / total;
+}
+
+void Remote::reportLoad()
+{
+    if (!mConnection || !mConnection->isConnected())
+        return;
+    Local& local = Daemon::instance()->local();
+    LoadMessage::Load load;
+    load.slots = std::max<int>(local.availableCount() - mRequestedCount, 0);
+    load.running = local.runningCount();
+    load.pending = local.pendingCount() + mPendingPreprocess.size();
+    for (const auto& pending : mPendingBuild) {
+        load.pending += pending.second.size();
+    }
+    for (const auto& jobs : mRemoteJobs) {
+        load.remote += jobs.second.size();
+    }
+    double avg;
+    if (getloadavg(&avg, 1) == 1)
+        load.loadAverage = static_cast<uint32_t>(avg * 100);
+    load.memory = memoryUsed();
+
+    const uint64_t now = Rct::monoMs();
+    if (!mLoadReported || now - mLoadReported >= LoadHeartbeat) {
+        // everything, in case the scheduler missed something
+        mConnection->send(LoadMessage(load));
+    } else {
+        const LoadMessage msg(load, mReportedLoad);
+        if (!msg.fields())
+            return;
+        mConnection->send(msg);
+    }
+    mReportedLoad = load;
+    mLoadReported = now;
+}
+
+void Remote::reportCompilers()
+{
+    if (!mConnection || !mConnection->isConnected())
+        return;
+    const uint32_t generation = CompilerVersion::generation();
+    if (generation == mReportedCompilers)
+        return;
+    mReportedCompilers = generation;
+    List<CompilersMessage::Compiler> compilers;
+    for (const CompilerVersion::SharedPtr& ver : CompilerVersion::versions()) {
+        compilers.append({ { ver->compiler(), ver->major(), ver->target() }, ver->hash() });
+    }
+    error() << "reporting" << compilers.size() << "compilers to the scheduler";
+    mConnection->send(CompilersMessage(compilers));
+}
+
+void Remote::reportStats()
+{
+    if (!mConnection || !mConnection->isConnected())
+        return;
+    const uint64_t now = Rct::monoMs();
+    if (mStatsReported && now - mStatsReported < StatsReportInterval)
+        return;
+    Map<String, uint64_t> stats;
+    stats["transfer.sent"] = mTransferStats.sent;
+    stats["transfer.sentWire"] = mTransferStats.sentWire;
+    stats["transfer.received"] = mTransferStats.received;
+    stats["transfer.receivedWire"] = mTransferStats.receivedWire;
+    stats["transfer.deduplicated"] = mTransferStats.deduplicated;
+    const Cache& cache = Daemon::instance()->cache();
+    if (cache.isEnabled()) {
+        const Cache::Stats& cs = cache.stats();
+        stats["cache.hits"] = cs.hits;
+        stats["cache.misses"] = cs.misses;
+        stats["cache.directHits"] = cs.directHits;
+        stats["cache.directMisses"] = cs.directMisses;
+        stats["cache.inserts"] = cs.inserts;
+        stats["cache.evictions"] = cs.evictions;
+        stats["cache.size"] = cache.size();
+    }
+    if (stats == mReportedStats)
+        return;
+    mConnection->send(StatsMessage(stats));
+    mReportedStats = std::move(stats);
+    mStatsReported = now;
+}
+
+void Remote::handleHandshakeMessage(const HandshakeMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+{
+    auto existing = mPeersByConn.find(conn);
+    if (existing != mPeersByConn.end()) {
+        // reply to our own handshake
+        existing->second.flags = msg->flags();
+        existing->second.compression = msg->compression();
+        existing->second.features = msg->features();
+        return;
+    }
+    Peer key = { conn->client()->peerName(), msg->port(), msg->flags(), msg->compression(), 0 };
+    key.features = msg->features();
+    if (mPeersByKey.contains(key)) {
+        // drop the connection
+        conn->finish();
+    } else {
+        mPeersByKey[key] = conn;
+        mPeersByConn[conn] = key;
+        const Daemon::Options& opts = Daemon::instance()->options();
+        conn->send(HandshakeMessage(opts.localPort, handshakeFlags(), opts.compression, plast::WireFeatures));
+    }
+}
+
+void Remote::send(const std::shared_ptr<Connection>& conn, Message& msg)
+{
+    auto peer = mPeersByConn.find(conn);
+    const uint8_t features = (peer != mPeersByConn.end() ? peer->second.features & plast::WireFeatures : 0);
+    List<plast::WireCompilerKey*> compilers;
+    switch (msg.messageId()) {
+    case JobMessage::MessageId:
+        static_cast<JobMessage&>(msg).setWireFeatures(features);
+        compilers.append(&static_cast<JobMessage&>(msg).compiler());
+        break;
+    case JobBatchMessage::MessageId:
+        static_cast<JobBatchMessage&>(msg).setWireFeatures(features);
+        for (const JobMessage::SharedPtr& job : static_cast<JobBatchMessage&>(msg).jobs()) {
+            compilers.append(&job->compiler());
+        }
+        break;
+    case RequestJobsMessage::MessageId:
+        static_cast<RequestJobsMessage&>(msg).setWireFeatures(features);
+        compilers.append(&static_cast<RequestJobsMessage&>(msg).compiler());
+        break;
+    case LastJobMessage::MessageId:
+        static_cast<LastJobMessage&>(msg).setWireFeatures(features);
+        compilers.append(&static_cast<LastJobMessage&>(msg).compiler());
+        break;
+    case JobResponseMessage::MessageId:
+        static_cast<JobResponseMessage&>(msg).setWireFeatures(features);
+        break;
+    case JobResponseBatchMessage::MessageId:
+        static_cast<JobResponseBatchMessage&>(msg).setWireFeatures(features);
+        break;
+    case JobDataMessage::MessageId:
+        static_cast<JobDataMessage&>(msg).setWireFeatures(features);
+        break;
+    default:
+        break;
+    }
+    if (features & plast::InternedCompilers) {
+        // ids are handed out in send order, so the peer always sees
+        // the definition before the first reference
+        Map<plast::CompilerKey, uint32_t>& ids = peer->second.compilersSent;
+        for (plast::WireCompilerKey* compiler : compilers) {
+            auto id = ids.find(compiler->key());
+            if (id == ids.end()) {
+                const uint32_t next = ids.size() + 1;
+                ids[compiler->key()] = next;
+                compiler->intern(next, true);
+            } else {
+                compiler->intern(id->second, false);
+            }
+        }
+    }
+    conn->send(msg);
 }
 
-void Remote::handleHandshakeMessage(const HandshakeMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+bool Remote::resolve(const std::shared_ptr<Connection>& conn, plast::WireCompilerKey& compiler)
 {
-    const Peer key = { conn->client()->peerName(), msg->port() };
-    if (mPeersByKey.contains(key)) {
-        // drop the connection
-        assert(!mPeersByConn.contains(conn));
-        conn->finish();
-    } else {
-        mPeersByKey[key] = conn;
-        mPeersByConn[conn] = key;
+    if (!compiler.id())
+        return true;
+    auto peer = mPeersByConn.find(conn);
+    if (peer == mPeersByConn.end())
+        return false;
+    Hash<uint32_t, plast::CompilerKey>& keys = peer->second.compilersReceived;
+    if (compiler.isDefined()) {
+        keys[compiler.id()] = compiler.key();
+        return true;
+    }
+    auto key = keys.find(compiler.id());
+    if (key == keys.end()) {
+        error() << "unknown compiler id" << compiler.id() << "from" << conn->client()->peerName();
+        return false;
     }
+    compiler.resolve(key->second);
+    return true;
 }
 
 void Remote::handleJobResponseMessage(const JobResponseMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
@@ -320,34 +1253,40 @@ void Remote::handleJobResponseMessage(const JobResponseMessage::SharedPtr& msg,
         return;
     }
     job->setExitCode(msg->exitCode());
-    const Job::Status status = job->status();
-    switch (status) {
-    case Job::RemotePending:
-        job->updateStatus(Job::RemoteReceiving);
-        assert(mCurPreprocessed > 0);
-        --mCurPreprocessed;
-        job->clearPreprocessed();
-        preprocessMore();
-        break;
-    case Job::RemoteReceiving:
-        // accept the above statuses
-        break;
-    default:
-        error() << "job no longer remote compiling";
-        assert(!mBuildingById.contains(job->id()));
+    uint64_t received = 0, started = 0, size = 0;
+    {
+        auto building = mBuildingById.find(job->id());
+        if (building != mBuildingById.end()) {
+            received = building->second->received;
+            started = building->second->started;
+            size = building->second->size;
+        }
+    }
+    if (!startReceiving(job))
         return;
+    {
+        auto building = mBuildingById.find(job->id());
+        if (building != mBuildingById.end())
+            building->second->progress = Rct::monoMs();
     }
     switch (msg->mode()) {
     case JobResponseMessage::Stdout:
-        job->mStdOut += msg->data();
-        job->mReadyReadStdOut(job.get());
+        job->mRemoteStdOut += msg->data();
         break;
     case JobResponseMessage::Stderr:
-        job->mStdErr += msg->data();
-        job->mReadyReadStdErr(job.get());
+        job->mRemoteStdErr += msg->data();
         break;
     case JobResponseMessage::Error:
         removeJob(job->id());
+        if (job->isPumped()) {
+            // most likely a header the scanner missed, do it the
+            // normal way rather than reporting the peer's errors
+            error() << "pumped job" << job->id() << "failed remotely, preprocessing locally";
+            job->stopPumping();
+            restart(job);
+            break;
+        }
+        releaseOutput(job);
         job->mError = msg->data();
         job->updateStatus(Job::Error);
         Job::finish(job.get());
@@ -355,23 +1294,72 @@ void Remote::handleJobResponseMessage(const JobResponseMessage::SharedPtr& msg,
     case JobResponseMessage::Compiled:
         error() << "job successfully remote compiled" << job->id();
         removeJob(job->id());
-        job->writeFile(msg->data());
+        if (started) {
+            const int took = Rct::monoMs() - started;
+            addSample(mDurations, took, DurationSamples);
+            auto peer = mPeersByConn.find(conn);
+            if (peer != mPeersByConn.end()) {
+                const uint64_t kb = std::max<uint64_t>(size, MinRateSize) / 1024;
+                addSample(peer->second.rates, static_cast<uint64_t>(took) * 1000 / kb, PeerSamples);
+            }
+        }
+        releaseOutput(job);
+        {
+            plast::Buffer data;
+            if (received && msg->data().isEmpty()) {
+                // streamed, already in place
+                if (!job->cacheKey().isEmpty())
+                    data = job->outputFile().readAll();
+            } else if (!uncompress(msg->buffer(), msg->compression(), data)) {
+                job->mError = "Unable to uncompress object code";
+                job->updateStatus(Job::Error);
+                Job::finish(job.get());
+                break;
+            } else {
+                job->writeFile(data.string());
+            }
+            job->addToCache(data.string());
+        }
         job->updateStatus(Job::Compiled);
         Job::finish(job.get());
         break;
     }
 }
 
+void Remote::handleJobResponseBatchMessage(const JobResponseBatchMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+{
+    error() << "handle job response batch" << msg->responses().size();
+    for (const JobResponseMessage::SharedPtr& response : msg->responses()) {
+        handleJobResponseMessage(response, conn);
+    }
+}
+
 void Remote::handleLastJobMessage(const LastJobMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
 {
     error() << "last job msg";
+    if (!resolve(conn, msg->compiler())) {
+        conn->finish();
+        return;
+    }
     const ConnectionKey ck = { conn, msg->compilerType(), msg->compilerMajor(), msg->compilerTarget() };
 
+    sampleRoundTrip(ck);
     auto it = mRequested.find(ck);
-    assert(it != mRequested.end());
-    assert(it->second >= msg->count());
-    mRequestedCount -= it->second;
-    mRequested.erase(it);
+    if (hasCreditFlow(conn)) {
+        // unused credit coming back
+        if (it != mRequested.end()) {
+            const int back = std::min(it->second, msg->count());
+            it->second -= back;
+            mRequestedCount -= back;
+            if (!it->second)
+                mRequested.erase(it);
+        }
+    } else {
+        assert(it != mRequested.end());
+        assert(it->second >= msg->count());
+        mRequestedCount -= it->second;
+        mRequested.erase(it);
+    }
 
     if (msg->hasMore()) {
         error() << "still has more";
@@ -379,6 +1367,7 @@ void Remote::handleLastJobMessage(const LastJobMessage::SharedPtr& msg, const st
     } else {
         error() << "no more" << conn;;
         mHasMore.erase(ck);
+        mShares.erase(ck);
     }
     requestMore();
 }
@@ -387,30 +1376,78 @@ void Remote::requestMore()
 {
     if (Daemon::instance()->local().availableCount() <= mRequestedCount)
         return;
-    for (const auto& it : mHasMore) {
-        if (!mRequested.contains(it)) {
-            requestMore(it);
-            return;
-        }
+    const List<ConnectionKey> keys = mHasMore.toList();
+    for (const ConnectionKey& key : keys) {
+        const std::shared_ptr<Connection> conn = key.conn.lock();
+        if (!conn)
+            continue;
+        // peers without credit flow answer every request before the next
+        if (hasCreditFlow(conn) || !mRequested.contains(key))
+            requestMore(key);
+    }
+}
+
+bool Remote::hasCreditFlow(const std::shared_ptr<Connection>& conn) const
+{
+    auto peer = mPeersByConn.find(conn);
+    return peer != mPeersByConn.end() && (peer->second.features & plast::CreditFlow);
+}
+
+int Remote::creditWindow(const std::shared_ptr<Connection>& conn) const
+{
+    // enough to keep every slot busy, plus whatever finishes while
+    // the next grant is on its way to the peer and the jobs come back
+    const Daemon::Options& opts = Daemon::instance()->options();
+    const int idle = Daemon::instance()->local().availableCount();
+    auto peer = mPeersByConn.find(conn);
+    if (peer == mPeersByConn.end() || !peer->second.rtt || !mCompileTime)
+        return idle;
+    const int inflight = (opts.jobCount * peer->second.rtt + mCompileTime - 1) / mCompileTime;
+    return idle + std::min(inflight, opts.jobCount);
+}
+
+void Remote::sampleRoundTrip(const ConnectionKey& key)
+{
+    auto granted = mGrantedAt.find(key);
+    if (granted == mGrantedAt.end())
+        return;
+    const int sample = Rct::monoMs() - granted->second;
+    mGrantedAt.erase(granted);
+    auto peer = mPeersByConn.find(key.conn.lock());
+    if (peer != mPeersByConn.end()) {
+        int& rtt = peer->second.rtt;
+        rtt = rtt ? (rtt * 7 + sample) / 8 : std::max(sample, 1);
     }
 }
 
 void Remote::requestMore(const ConnectionKey& key)
 {
-    const uint32_t idle = Daemon::instance()->local().availableCount();
-    if (idle > mRequestedCount) {
-        const int count = std::min<int>(idle - mRequestedCount, 5);
-        error() << "asking for" << count << "since" << mRequestedCount << "<" << idle;
-        mRequestedCount += count;
-        mRequested[key] = count;
-        std::shared_ptr<Connection> conn = key.conn.lock();
-        if (!conn) {
-            error() << "connection dead" << __FILE__ << __LINE__;
-            return;
+    std::shared_ptr<Connection> conn = key.conn.lock();
+    if (!conn) {
+        error() << "connection dead" << __FILE__ << __LINE__;
+        return;
+    }
+    const bool credit = hasCreditFlow(conn);
+    const int window = credit ? creditWindow(conn) : Daemon::instance()->local().availableCount();
+    int count = 0;
+    if (window > mRequestedCount) {
+        count = credit ? window - mRequestedCount : std::min<int>(window - mRequestedCount, 5);
+        // no more than our share of the requester's jobs at a time
+        auto share = mShares.find(key);
+        if (share != mShares.end()) {
+            auto requested = mRequested.find(key);
+            count = std::min(count, share->second - (requested != mRequested.end() ? requested->second : 0));
         }
-        conn->send(RequestJobsMessage(key.type, key.major, key.target, count));
+    }
+    if (count > 0) {
+        error() << "asking for" << count << "since" << mRequestedCount << "<" << window;
+        mRequestedCount += count;
+        mRequested[key] += count;
+        if (!mGrantedAt.contains(key))
+            mGrantedAt[key] = Rct::monoMs();
+        send(conn, RequestJobsMessage(key.type, key.major, key.target, count));
     } else {
-        error() << "not asking," << mRequestedCount << ">=" << idle;
+        error() << "not asking," << mRequestedCount << "of" << window << "requested";
     }
 }
 
@@ -421,8 +1458,7 @@ void Remote::preprocessMore()
         const auto& pre = mPendingPreprocess.front();
         const Job::SharedPtr job = pre.job.lock();
         if (job) {
-            const plast::CompilerKey k = pre.key;
-            job->statusChanged().connect([this, k](Job* job, Job::Status status, Job::Status oldStatus) {
+            job->statusChanged().connect([this](Job* job, Job::Status status, Job::Status oldStatus) {
                     switch (status) {
                     case Job::Aborted:
                     case Job::Error:
@@ -436,10 +1472,12 @@ void Remote::preprocessMore()
                         break;
                     case Job::Preprocessed:
                         error() << "preproc size" << job->preprocessed().size();
-                        mPendingBuild[k].push_back(job->shared_from_this());
-                        // send a HasJobsMessage to the scheduler
-                        mConnection->send(HasJobsMessage(k.type, k.major, k.target, mPendingBuild[k].size(),
-                                                         Daemon::instance()->options().localPort));
+                        if (job->startFromCache()
+                            || coalesce(job->shared_from_this())
+                            || fetchFromCluster(job->shared_from_this())) {
+                            break;
+                        }
+                        dispatchPreprocessed(job->shared_from_this());
                         break;
                     default:
                         break;
@@ -454,6 +1492,314 @@ void Remote::preprocessMore()
     }
 }
 
+void Remote::dispatchPreprocessed(const Job::SharedPtr& job)
+{
+    assert(job->status() == Job::Preprocessed);
+    Local& local = Daemon::instance()->local();
+    if (!job->cacheKey().isEmpty() && local.isAvailable()) {
+        // only went through preprocessing for the cache lookup
+        local.post(job);
+        return;
+    }
+    const plast::CompilerKey k = { job->compilerType(), job->compilerMajor(), job->compilerTarget() };
+    auto& pending = mPendingBuild[k];
+    pending.push_back(job);
+    // send a HasJobsMessage to the scheduler
+    mConnection->send(HasJobsMessage(k.type, k.major, k.target, pending.size(),
+                                     Daemon::instance()->options().localPort));
+}
+
+bool Remote::coalesce(const Job::SharedPtr& job)
+{
+    const String key = job->cacheKey();
+    if (key.isEmpty() || job->type() != Job::LocalJob)
+        return false;
+
+    auto it = mInFlight.find(key);
+    if (it != mInFlight.end()) {
+        if (it->second.leader == job->id()) {
+            // preprocessed again after a hard reschedule
+            return false;
+        }
+        error() << "job" << job->id() << "waiting for identical job" << it->second.leader;
+        it->second.waiters.append(job);
+        return true;
+    }
+
+    if (mInFlight.isEmpty())
+        mInFlightTimer.restart(InFlightCheck);
+    InFlight& inflight = mInFlight[key];
+    inflight.leader = job->id();
+    inflight.started = Rct::monoMs();
+    job->statusChanged().connect([this](Job* job, Job::Status status, Job::Status) {
+            switch (status) {
+            case Job::Compiled:
+            case Job::Error:
+            case Job::Aborted:
+                finishInFlight(job, status);
+                break;
+            default:
+                break;
+            }
+        });
+    job->destroyed().connect([this](Job* job) {
+            finishInFlight(job, Job::Aborted);
+        });
+    return false;
+}
+
+void Remote::finishInFlight(Job* leader, Job::Status status)
+{
+    auto it = mInFlight.find(leader->cacheKey());
+    if (it == mInFlight.end() || it->second.leader != leader->id())
+        return;
+    const List<Job::WeakPtr> waiters = it->second.waiters;
+    mInFlight.erase(it);
+    if (mInFlight.isEmpty())
+        mInFlightTimer.stop();
+
+    const String data = (status == Job::Compiled ? leader->outputFile().readAll() : String());
+    if (data.isEmpty()) {
+        // failed or aborted, every waiter builds it. a compile error
+        // is reported by each job again
+        releaseWaiters(waiters);
+        return;
+    }
+    for (const Job::WeakPtr& weak : waiters) {
+        const Job::SharedPtr job = weak.lock();
+        if (!job || job->status() != Job::Preprocessed)
+            continue;
+        error() << "job" << job->id() << "served by identical job" << leader->id();
+        job->finishFromIdentical(leader, String(data));
+    }
+}
+
+void Remote::releaseWaiters(const List<Job::WeakPtr>& waiters)
+{
+    for (const Job::WeakPtr& weak : waiters) {
+        const Job::SharedPtr job = weak.lock();
+        if (job && job->status() == Job::Preprocessed)
+            dispatchPreprocessed(job);
+    }
+}
+
+bool Remote::fetchFromCluster(const Job::SharedPtr& job)
+{
+    const String key = job->cacheKey();
+    CacheRing::Member owner;
+    if (key.isEmpty() || !mCacheRing.owner(key, owner) || owner.self)
+        return false;
+
+    auto fetch = mClusterFetches.find(key);
+    if (fetch != mClusterFetches.end()) {
+        // already asked for this one
+        fetch->second.jobs.append(job);
+        return true;
+    }
+    // connecting first would cost more than building it, the
+    // connection is made when we store something there
+    const Peer peer = { owner.host, owner.port, HandshakeMessage::None, plast::NoCompression, 0 };
+    auto connected = mPeersByKey.find(peer);
+    if (connected == mPeersByKey.end())
+        return false;
+    std::shared_ptr<Connection> conn = connected->second.lock();
+    if (!conn)
+        return false;
+    if (mClusterFetches.isEmpty())
+        mClusterTimer.restart(ClusterFetchCheck);
+    ClusterFetch& added = mClusterFetches[key];
+    added.started = Rct::monoMs();
+    added.jobs.append(job);
+    warning() << "asking" << owner.host << owner.port << "for" << key;
+    conn->send(CacheMessage(CacheMessage::Get, key));
+    return true;
+}
+
+void Remote::storeInCluster(const String& key, const String& data)
+{
+    CacheRing::Member owner;
+    if (!mCacheRing.owner(key, owner) || owner.self)
+        return;
+    std::shared_ptr<Connection> conn = connectToPeer(owner.host, owner.port);
+    if (conn)
+        conn->send(CacheMessage(CacheMessage::Put, key, String(data)));
+}
+
+void Remote::handleCacheMessage(const CacheMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+{
+    Cache& cache = Daemon::instance()->cache();
+    const String key = msg->key();
+    switch (msg->type()) {
+    case CacheMessage::Get: {
+        String data;
+        if (cache.get(key, data)) {
+            conn->send(CacheMessage(CacheMessage::Found, key, std::move(data)));
+        } else {
+            conn->send(CacheMessage(CacheMessage::NotFound, key));
+        }
+        break; }
+    case CacheMessage::Put: {
+        CacheRing::Member owner;
+        if (!mCacheRing.owner(key, owner) || !owner.self || !msg->isIntact()) {
+            error() << "dropping cluster cache entry" << key << "from" << conn->client()->peerName();
+            break;
+        }
+        cache.insert(key, msg->data());
+        break; }
+    case CacheMessage::Found:
+    case CacheMessage::NotFound: {
+        auto fetch = mClusterFetches.find(key);
+        if (fetch == mClusterFetches.end()) {
+            // timed out already
+            return;
+        }
+        const List<Job::WeakPtr> jobs = fetch->second.jobs;
+        mClusterFetches.erase(fetch);
+        if (mClusterFetches.isEmpty())
+            mClusterTimer.stop();
+
+        bool found = msg->type() == CacheMessage::Found;
+        if (found && !msg->isIntact()) {
+            error() << "damaged cluster cache entry" << key << "from" << conn->client()->peerName();
+            found = false;
+        }
+        const String data = found ? msg->data() : String();
+        if (found)
+            cache.insert(key, data);
+        for (const Job::WeakPtr& weak : jobs) {
+            const Job::SharedPtr job = weak.lock();
+            if (!job || job->status() != Job::Preprocessed)
+                continue;
+            if (found) {
+                error() << "job" << job->id() << "served from cluster cache" << key;
+                job->addToDirectCache();
+                job->finishFromCache(String(data));
+            } else {
+                dispatchPreprocessed(job);
+            }
+        }
+        break; }
+    }
+}
+
+void Remote::handleCacheRingMessage(const CacheRingMessage::SharedPtr& msg)
+{
+    List<CacheRing::Member> members;
+    const List<CacheRingMessage::Member> ring = msg->members();
+    for (int i=0; i<ring.size(); ++i) {
+        members.append({ ring.at(i).host, ring.at(i).port, i == msg->self() });
+    }
+    mCacheRing.setMembers(members);
+}
+
+std::shared_ptr<Connection> Remote::connectToPeer(const String& host, uint16_t port)
+{
+    const Peer key = { host, port, HandshakeMessage::None, plast::NoCompression, 0 };
+    auto peer = mPeersByKey.find(key);
+    if (peer != mPeersByKey.end())
+        return peer->second.lock();
+
+    // make connection
+    SocketClient::SharedPtr client = std::make_shared<SocketClient>();
+    client->connect(key.peer, key.port);
+    std::shared_ptr<Connection> conn = addClient(client);
+
+    mPeersByKey[key] = conn;
+    mPeersByConn[conn] = key;
+
+    const Daemon::Options& opts = Daemon::instance()->options();
+    conn->send(HandshakeMessage(opts.localPort, handshakeFlags(), opts.compression, plast::WireFeatures));
+    return conn;
+}
+
+String Remote::compress(const std::shared_ptr<Connection>& conn, const String& data, plast::Compression& compression)
+{
+    String out;
+    if (!compress(conn, data, compression, out))
+        return data;
+    return out;
+}
+
+String Remote::compress(const std::shared_ptr<Connection>& conn, String&& data, plast::Compression& compression)
+{
+    String out;
+    if (!compress(conn, data, compression, out))
+        return std::move(data);
+    return out;
+}
+
+bool Remote::compress(const std::shared_ptr<Connection>& conn, const String& data, plast::Compression& compression, String& out)
+{
+    return compress(conn, data.constData(), data.size(), compression, out);
+}
+
+bool Remote::compress(const std::shared_ptr<Connection>& conn, const char* data, size_t size,
+                      plast::Compression& compression, String& out)
+{
+    compression = plast::NoCompression;
+    mTransferStats.sent += size;
+    auto peer = mPeersByConn.find(conn);
+    const uint32_t mask = (peer != mPeersByConn.end()
+                           ? peer->second.compression & Daemon::instance()->options().compression
+                           : 0);
+    // the peer wouldn't uncompress anything larger
+    if (!mask || size < MinCompressSize || size > plast::MaxUncompressedSize) {
+        mTransferStats.sentWire += size;
+        return false;
+    }
+
+    // lz4 while the link keeps up, a growing backlog means the link
+    // is the bottleneck so spend more cpu on zstd until it drains
+    int& level = peer->second.compressionLevel;
+    const int pending = conn->pendingWrite();
+    if (pending > CompressionBacklog) {
+        level = std::min<int>(level + 1, MaxAdaptiveLevel);
+    } else if (pending < CompressionBacklog && level > 0) {
+        --level;
+    }
+    if ((mask & plast::ZstdCompression) && (level > 0 || !(mask & plast::LZ4Compression))) {
+        compression = plast::ZstdCompression;
+    } else {
+        compression = plast::LZ4Compression;
+    }
+
+    out = plast::compress(data, size, compression, std::max(level, 1));
+    if (out.isEmpty() || static_cast<size_t>(out.size()) >= size) {
+        compression = plast::NoCompression;
+        mTransferStats.sentWire += size;
+        return false;
+    }
+    mTransferStats.sentWire += out.size();
+    warning() << "compressed" << size << "to" << out.size() << plast::compressionName(compression)
+              << "level" << level << "total" << mTransferStats.sent << "->" << mTransferStats.sentWire;
+    return true;
+}
+
+bool Remote::uncompress(const plast::Buffer& data, plast::Compression compression, plast::Buffer& out)
+{
+    if (compression != plast::NoCompression) {
+        String uncompressed;
+        if (!uncompress(data.string(), compression, uncompressed))
+            return false;
+        out = std::move(uncompressed);
+        return true;
+    }
+    // nothing to do, share it
+    out = data;
+    mTransferStats.receivedWire += data.size();
+    mTransferStats.received += data.size();
+    return true;
+}
+
+bool Remote::uncompress(const String& data, plast::Compression compression, String& out)
+{
+    if (!plast::uncompress(data, compression, out))
+        return false;
+    mTransferStats.receivedWire += data.size();
+    mTransferStats.received += out.size();
+    return true;
+}
+
 void Remote::removeJob(uint64_t id)
 {
     auto idit = mBuildingById.find(id);
@@ -481,7 +1827,6 @@ void Remote::removeJob(uint64_t id)
 
 Job::SharedPtr Remote::take()
 {
-#warning we should probably only take these after some timeout since we already paid the cost of preprocessing
     // prefer jobs that are not sent out
     while (!mPendingBuild.isEmpty()) {
         auto p = mPendingBuild.begin();
@@ -491,42 +1836,156 @@ Job::SharedPtr Remote::take()
         if (p->second.isEmpty())
             mPendingBuild.erase(p);
         if (job) {
-#warning should use the preprocessed data
-            job->clearPreprocessed();
+            if (job->isPumped()) {
+                // never preprocessed, still idle
+                return job;
+            }
+            // local compiles the preprocessed data and lets us know
             job->updateStatus(Job::Idle);
-            assert(mCurPreprocessed > 0);
-            --mCurPreprocessed;
-            preprocessMore();
             return job;
         }
     }
+    // then the oldest of the jobs that are out for longer than most
+    // jobs take. they stay with the peer as well and whichever copy
+    // finishes first wins, local runs these with the job still
+    // RemotePending
+    const int delay = hedgeDelay();
+    if (delay >= 0) {
+        const uint64_t now = Rct::monoMs();
+        for (const auto& time : mBuildingByTime) {
+            if (now - time.first < static_cast<uint64_t>(delay))
+                break;
+            for (const auto& cand : time.second) {
+                Job::SharedPtr job = cand->job.lock();
+                if (job && !cand->hedged && job->status() == Job::RemotePending) {
+                    error() << "hedging job" << job->id() << "out for" << (now - time.first) << "ms";
+                    cand->hedged = true;
+                    return job;
+                }
+            }
+        }
+    }
     // take newest pending jobs first, the assumption is that this
     // will be the job that will take the longest to get back to us
     auto time = mBuildingByTime.rbegin();
     while (time != mBuildingByTime.rend()) {
         for (auto cand : time->second) {
             Job::SharedPtr job = cand->job.lock();
-            if (job && job->status() == Job::RemotePending) {
-#warning should we take jobs we have partially received in case the connection times out?
+            if (job && !cand->hedged && job->status() == Job::RemotePending) {
                 // we can take this job since we haven't received any data for it yet
+                cancel(*cand);
                 job->increaseSerial();
                 const uint64_t id = cand->jobid;
                 assert(id == job->id());
                 removeJob(id);
-                assert(!job->mPreprocessed.isEmpty());
-                job->clearPreprocessed();
                 job->updateStatus(Job::Idle);
-                assert(mCurPreprocessed > 0);
-                --mCurPreprocessed;
-                preprocessMore();
+                assert(job->isPumped() || job->isPreprocessed());
                 return job;
             }
         }
         ++time;
     }
+    // and jobs that started coming back but stalled. their preprocessed
+    // data is gone so local compiles them from the source
+    const uint64_t now = Rct::monoMs();
+    for (const auto& time : mBuildingByTime) {
+        for (const auto& cand : time.second) {
+            Job::SharedPtr job = cand->job.lock();
+            if (job && job->status() == Job::RemoteReceiving
+                && now - cand->progress >= static_cast<uint64_t>(stallTimeout(*cand))) {
+                error() << "taking stalled job" << job->id() << "no progress for" << (now - cand->progress) << "ms";
+                cancel(*cand);
+                job->increaseSerial();
+                job->mRemoteStdOut.clear();
+                job->mRemoteStdErr.clear();
+                removeJob(cand->jobid);
+                job->updateStatus(Job::Idle);
+                return job;
+            }
+        }
+    }
     return Job::SharedPtr();
 }
 
+void Remote::cancel(const Building& building)
+{
+    const std::shared_ptr<Connection> conn = building.conn.lock();
+    if (!conn)
+        return;
+    auto peer = mPeersByConn.find(conn);
+    if (peer == mPeersByConn.end() || !(peer->second.features & plast::JobCancel))
+        return;
+    error() << "cancelling job" << building.jobid << "serial" << building.serial << "on" << peer->second.peer;
+    // behind whatever we still have queued for the job
+    sendBulk(conn, JobDataMessage::Payload, std::make_shared<CancelJobMessage>(building.jobid, building.serial));
+}
+
+void Remote::handleCancelJobMessage(const CancelJobMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn)
+{
+    error() << "handle cancel job" << msg->id() << "serial" << msg->serial();
+    {
+        // taken back before we got the payload
+        auto requested = mPayloadRequested.find(conn);
+        if (requested != mPayloadRequested.end()) {
+            auto it = requested->second.find(msg->id());
+            if (it != requested->second.end() && it->second == msg->serial()) {
+                requested->second.erase(it);
+                if (requested->second.isEmpty())
+                    mPayloadRequested.erase(requested);
+            }
+        }
+    }
+    auto jobs = mRemoteJobs.find(conn);
+    if (jobs == mRemoteJobs.end())
+        return;
+    auto it = jobs->second.find(msg->id());
+    if (it == jobs->second.end())
+        return;
+    const Job::SharedPtr job = it->second.lock();
+    if (!job || job->serial() != msg->serial())
+        return;
+    auto streams = mStreams.find(conn);
+    if (streams != mStreams.end()) {
+        streams->second.erase(msg->id());
+        if (streams->second.isEmpty())
+            mStreams.erase(streams);
+    }
+    // local kills the compiler when the job goes away
+    job->abort();
+}
+
+void Remote::restart(const Job::SharedPtr& job)
+{
+    // anything still coming from the old attempt has the old serial
+    job->mRemoteStdOut.clear();
+    job->mRemoteStdErr.clear();
+    job->updateStatus(Job::Idle);
+    job->increaseSerial();
+    job->start();
+}
+
+void Remote::releaseOutput(const Job::SharedPtr& job)
+{
+    if (!job->mRemoteStdOut.isEmpty()) {
+        job->mStdOut += job->mRemoteStdOut;
+        job->mRemoteStdOut.clear();
+        job->mReadyReadStdOut(job.get());
+    }
+    if (!job->mRemoteStdErr.isEmpty()) {
+        job->mStdErr += job->mRemoteStdErr;
+        job->mRemoteStdErr.clear();
+        job->mReadyReadStdErr(job.get());
+    }
+}
+
+int Remote::stallTimeout(const Building& building) const
+{
+    auto peer = mPeersByConn.find(building.conn.lock());
+    if (peer == mPeersByConn.end() || peer->second.latencies.size() < MinPeerSamples)
+        return mRescheduleTimeout;
+    return std::max<int>(percentile(peer->second.latencies, ReschedulePercentile) * QuietFactor, MinStallTimeout);
+}
+
 std::shared_ptr<Connection> Remote::addClient(const SocketClient::SharedPtr& client)
 {
     error() << "remote client added";
@@ -535,6 +1994,11 @@ std::shared_ptr<Connection> Remote::addClient(const SocketClient::SharedPtr& cli
     conns.insert(conn);
     conn->newMessage().connect([this](const std::shared_ptr<Message>& msg, const std::shared_ptr<Connection> &conn) {
             error() << "Got a message" << msg->messageId() << __LINE__;
+            {
+                auto peer = mPeersByConn.find(conn);
+                if (peer != mPeersByConn.end())
+                    peer->second.lastHeard = Rct::monoMs();
+            }
             switch (msg->messageId()) {
             case JobMessage::MessageId:
                 handleJobMessage(std::static_pointer_cast<JobMessage>(msg), conn);
@@ -551,15 +2015,70 @@ std::shared_ptr<Connection> Remote::addClient(const SocketClient::SharedPtr& cli
             case LastJobMessage::MessageId:
                 handleLastJobMessage(std::static_pointer_cast<LastJobMessage>(msg), conn);
                 break;
+            case RequestPayloadMessage::MessageId:
+                handleRequestPayloadMessage(std::static_pointer_cast<RequestPayloadMessage>(msg), conn);
+                break;
+            case CacheMessage::MessageId:
+                handleCacheMessage(std::static_pointer_cast<CacheMessage>(msg), conn);
+                break;
+            case JobDataMessage::MessageId:
+                handleJobDataMessage(std::static_pointer_cast<JobDataMessage>(msg), conn);
+                break;
+            case JobBatchMessage::MessageId:
+                handleJobBatchMessage(std::static_pointer_cast<JobBatchMessage>(msg), conn);
+                break;
+            case JobResponseBatchMessage::MessageId:
+                handleJobResponseBatchMessage(std::static_pointer_cast<JobResponseBatchMessage>(msg), conn);
+                break;
+            case CancelJobMessage::MessageId:
+                handleCancelJobMessage(std::static_pointer_cast<CancelJobMessage>(msg), conn);
+                break;
             default:
                 error() << "Unexpected message Remote::addClient" << msg->messageId();
                 conn->finish(1);
                 break;
             }
         });
+    conn->sendFinished().connect([this](const std::shared_ptr<Connection> &conn) {
+            if (!mOutgoing.contains(conn))
+                return;
+            // not from inside a send of our own
+            std::weak_ptr<Connection> weakConn = conn;
+            EventLoop::eventLoop()->callLater([this, weakConn]() {
+                    if (std::shared_ptr<Connection> conn = weakConn.lock())
+                        sendMore(conn);
+                });
+        });
     conn->disconnected().connect([this](const std::shared_ptr<Connection> &conn) {
             conn->disconnected().disconnect();
 
+            mOutgoing.erase(conn);
+            mResponses.erase(conn);
+            mPayloadRequested.erase(conn);
+
+            // the rest of these will never arrive
+            auto streams = mStreams.find(conn);
+            if (streams != mStreams.end()) {
+                const Hash<uint64_t, Job::WeakPtr> jobs = streams->second;
+                mStreams.erase(streams);
+                for (const auto& stream : jobs) {
+                    const Job::SharedPtr job = stream.second.lock();
+                    if (job)
+                        job->abort();
+                }
+            }
+            // nobody left to send the rest to, queued or running
+            auto remoteJobs = mRemoteJobs.find(conn);
+            if (remoteJobs != mRemoteJobs.end()) {
+                const Hash<uint64_t, Job::WeakPtr> jobs = remoteJobs->second;
+                mRemoteJobs.erase(remoteJobs);
+                for (const auto& remoteJob : jobs) {
+                    const Job::SharedPtr job = remoteJob.second.lock();
+                    if (job)
+                        job->abort();
+                }
+            }
+
             auto ck = mRequested.begin();
             while (ck != mRequested.end()) {
                 if (ck->first.conn.lock() == conn) {
@@ -570,6 +2089,36 @@ std::shared_ptr<Connection> Remote::addClient(const SocketClient::SharedPtr& cli
                     ++ck;
                 }
             }
+            {
+                auto it = mGrantedAt.begin();
+                while (it != mGrantedAt.end()) {
+                    if (it->first.conn.lock() == conn) {
+                        mGrantedAt.erase(it++);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            {
+                auto it = mShares.begin();
+                while (it != mShares.end()) {
+                    if (it->first.conn.lock() == conn) {
+                        mShares.erase(it++);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            {
+                auto it = mHasMore.begin();
+                while (it != mHasMore.end()) {
+                    if (it->conn.lock() == conn) {
+                        mHasMore.erase(it++);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
             // go through all pending jobs, we'll need to hard
             // reschedule all jobs from this connection
             {
@@ -585,14 +2134,18 @@ std::shared_ptr<Connection> Remote::addClient(const SocketClient::SharedPtr& cli
                                 assert(j->status() != Job::Compiled);
                                 assert(j->id() == (*b)->jobid);
 
+                                const bool hedged = (*b)->hedged;
                                 b = t->second.erase(b);
                                 assert(mBuildingById.contains(j->id()));
                                 mBuildingById.erase(j->id());
 
+                                if (hedged) {
+                                    // our local copy is all that's left
+                                    error() << "hedged job" << j->id() << "lost its peer";
+                                    continue;
+                                }
                                 error() << "hard rescheduling" << j->id();
-                                j->updateStatus(Job::Idle);
-                                j->increaseSerial();
-                                j->start();
+                                restart(j);
                                 continue;
                             } else {
                                 // no job? that's strange. take it out
@@ -629,6 +2182,12 @@ std::shared_ptr<Connection> Remote::addClient(const SocketClient::SharedPtr& cli
 void Remote::handleJobDestroyed(Job* job)
 {
     error() << "job dead" << job->id();
+    {
+        // aborted, or a hedge won while the peer was still at it
+        auto building = mBuildingById.find(job->id());
+        if (building != mBuildingById.end())
+            cancel(*building->second);
+    }
     removeJob(job->id());
     if (job->isPreprocessed()) {
         assert(mCurPreprocessed > 0);
@@ -637,6 +2196,48 @@ void Remote::handleJobDestroyed(Job* job)
     }
 }
 
+int Remote::hedgeDelay() const
+{
+    if (mDurations.size() < MinHedgeSamples)
+        return -1;
+    return std::max<int>(percentile(mDurations, HedgePercentile), MinHedgeDelay);
+}
+
+int Remote::rescheduleTimeout(const Building& building, uint64_t now) const
+{
+    const int64_t backoff = std::max<uint32_t>(1, building.serial);
+    auto peer = mPeersByConn.find(building.conn.lock());
+    if (peer == mPeersByConn.end()
+        || peer->second.latencies.size() < MinPeerSamples || peer->second.rates.size() < MinPeerSamples) {
+        return mRescheduleTimeout * backoff;
+    }
+    const Peer& p = peer->second;
+    // what this peer usually needs to answer plus what a job this size
+    // usually takes it, with room to spare
+    const int64_t latency = percentile(p.latencies, ReschedulePercentile);
+    const int64_t kb = std::max<uint64_t>(building.size, MinRateSize) / 1024;
+    const int64_t expected = latency + percentile(p.rates, ReschedulePercentile) * kb / 1000;
+    int64_t timeout = std::max<int64_t>(expected * RescheduleMargin, MinRescheduleTimeout);
+
+    // a peer that has gone quiet gets less time the longer it stays quiet
+    const int64_t quietAfter = std::max<int64_t>(latency * QuietFactor, MinRescheduleTimeout);
+    const int64_t quiet = now - std::max(p.lastHeard, building.started);
+    if (quiet > quietAfter)
+        timeout /= 1 + quiet / quietAfter;
+    return std::min<int64_t>(timeout * backoff, std::numeric_limits<int>::max());
+}
+
+bool Remote::hedgeFailed(const Job::SharedPtr& job)
+{
+    auto building = mBuildingById.find(job->id());
+    if (building == mBuildingById.end() || !building->second->hedged)
+        return false;
+    // leave it to the peer
+    error() << "local copy of hedged job" << job->id() << "failed";
+    building->second->hedged = false;
+    return true;
+}
+
 void Remote::compilingLocally(const Job::SharedPtr& job)
 {
     assert(job->isPreprocessed());
@@ -653,7 +2254,7 @@ void Remote::post(const Job::SharedPtr& job)
 
     // queue for preprocess if not already done
     const plast::CompilerKey k = { job->compilerType(), job->compilerMajor(), job->compilerTarget() };
-    if (!job->isPreprocessed()) {
+    if (!job->isPreprocessed() && !job->isPumped()) {
         mPendingPreprocess.push_back({ k, job });
         preprocessMore();
     } else {
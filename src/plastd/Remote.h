@@ -1,6 +1,8 @@
 #ifndef REMOTE_H
 #define REMOTE_H
 
+#include "CacheRing.h"
+#include "ChunkStore.h"
 #include "Job.h"
 #include "Preprocessor.h"
 #include <rct/Hash.h>
@@ -14,6 +16,7 @@
 #include <rct/Timer.h>
 #include <Messages.h>
 #include <Plast.h>
+#include <functional>
 #include <memory>
 #include <cstdint>
 
@@ -28,11 +31,31 @@ public:
     void post(const Job::SharedPtr& job);
     Job::SharedPtr take();
     void compilingLocally(const Job::SharedPtr& job);
+    // the local copy of a hedged job failed, false if the peer
+    // doesn't have it anymore either
+    bool hedgeFailed(const Job::SharedPtr& job);
 
     void requestMore();
 
+    // send an object to the peer owning its key in the cluster cache
+    void storeInCluster(const String& key, const String& data);
+
     std::shared_ptr<Connection> scheduler() { return mConnection; }
 
+    // payload bytes before and after compression
+    struct TransferStats
+    {
+        TransferStats()
+            : sent(0), sentWire(0), received(0), receivedWire(0), deduplicated(0)
+        {
+        }
+
+        uint64_t sent, sentWire, received, receivedWire;
+        // preprocessed bytes the peer already had in its chunk store
+        uint64_t deduplicated;
+    };
+    const TransferStats& transferStats() const { return mTransferStats; }
+
 private:
     std::shared_ptr<Connection> addClient(const SocketClient::SharedPtr& client);
     void handleJobMessage(const JobMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
@@ -41,9 +64,70 @@ private:
     void handleHandshakeMessage(const HandshakeMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
     void handleJobResponseMessage(const JobResponseMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
     void handleLastJobMessage(const LastJobMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
+    void handleRequestPayloadMessage(const RequestPayloadMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
+    void handleJobDataMessage(const JobDataMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
+    void handleJobBatchMessage(const JobBatchMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
+    void handleJobResponseBatchMessage(const JobResponseBatchMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
+    void handleCancelJobMessage(const CancelJobMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
+    void sendJob(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn, bool withPayload);
+    void sendJob(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn,
+                 const JobMessage::SharedPtr& msg, bool withPayload);
+    // 0 if the job has to be streamed
+    JobMessage::SharedPtr jobMessage(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn, bool withPayload);
+    void sendResponse(const std::shared_ptr<Connection>& conn, const JobResponseMessage::SharedPtr& response);
+    void flushResponses(const std::shared_ptr<Connection>& conn);
+    // object code or responses waiting in the bulk queue, anything we
+    // answer after has to go behind them
+    bool hasQueuedResponses(const std::shared_ptr<Connection>& conn) const;
+    void sendPumped(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn);
+    // hashes are the store entries the root links to, in use until
+    // released
+    bool preparePumpRoot(const JobMessage::SharedPtr& msg, Path& root, List<String>& hashes);
+    void releasePumped(const List<String>& hashes);
+    void evictPumped();
+    JobMessage::SharedPtr chunkedJobMessage(const Job::SharedPtr& job, const std::shared_ptr<Connection>& conn);
+    void sendChunks(const std::shared_ptr<Connection>& conn, JobDataMessage::Type type,
+                    uint64_t id, uint32_t serial, const plast::Buffer& data,
+                    std::function<void()>&& done = std::function<void()>());
+    void sendBulk(const std::shared_ptr<Connection>& conn, JobDataMessage::Type type,
+                  const std::shared_ptr<Message>& msg);
+    void sendMore(const std::shared_ptr<Connection>& conn);
+    // encoded for what the peer understands
+    void send(const std::shared_ptr<Connection>& conn, Message& msg);
+    void send(const std::shared_ptr<Connection>& conn, Message&& msg) { send(conn, msg); }
+    bool resolve(const std::shared_ptr<Connection>& conn, plast::WireCompilerKey& compiler);
+    bool startReceiving(const Job::SharedPtr& job);
+    void handleCacheMessage(const CacheMessage::SharedPtr& msg, const std::shared_ptr<Connection>& conn);
+    void handleCacheRingMessage(const CacheRingMessage::SharedPtr& msg);
+    // tell the scheduler how busy we are, if that changed
+    void reportLoad();
+    // and what we can build, likewise
+    void reportCompilers();
+    // our counters, for the dashboard
+    void reportStats();
+    bool fetchFromCluster(const Job::SharedPtr& job);
+    bool coalesce(const Job::SharedPtr& job);
+    void finishInFlight(Job* leader, Job::Status status);
+    // let the waiters build it themselves
+    void releaseWaiters(const List<Job::WeakPtr>& waiters);
+    void dispatchPreprocessed(const Job::SharedPtr& job);
+    std::shared_ptr<Connection> connectToPeer(const String& host, uint16_t port);
+    String compress(const std::shared_ptr<Connection>& conn, const String& data, plast::Compression& compression);
+    String compress(const std::shared_ptr<Connection>& conn, String&& data, plast::Compression& compression);
+    bool compress(const std::shared_ptr<Connection>& conn, const String& data, plast::Compression& compression, String& out);
+    bool compress(const std::shared_ptr<Connection>& conn, const char* data, size_t size,
+                  plast::Compression& compression, String& out);
+    bool uncompress(const String& data, plast::Compression compression, String& out);
+    bool uncompress(const plast::Buffer& data, plast::Compression compression, plast::Buffer& out);
     void handleJobDestroyed(Job* job);
     void removeJob(uint64_t id);
     void preprocessMore();
+    // new attempt with a new serial
+    void restart(const Job::SharedPtr& job);
+    // the peer's stdout and stderr for the job, once its attempt is done
+    void releaseOutput(const Job::SharedPtr& job);
+    // how long a job may be out before we hedge it, -1 without enough samples
+    int hedgeDelay() const;
 
     struct ConnectionKey
     {
@@ -70,31 +154,49 @@ private:
         }
     };
     void requestMore(const ConnectionKey& conn);
+    void pushJobs(const ConnectionKey& key, const std::shared_ptr<Connection>& conn, int credit);
+    int creditWindow(const std::shared_ptr<Connection>& conn) const;
+    bool hasCreditFlow(const std::shared_ptr<Connection>& conn) const;
+    void sampleRoundTrip(const ConnectionKey& key);
 
 private:
     SocketServer mServer;
     std::shared_ptr<Connection> mConnection;
     Preprocessor mPreprocessor;
     uint32_t mNextId;
-    Timer mRescheduleTimer, mReconnectTimer;
+    Timer mRescheduleTimer, mReconnectTimer, mClusterTimer, mLoadTimer, mInFlightTimer;
 
     struct Building
     {
         Building()
-            : started(0), jobid(0), serial(0)
+            : started(0), jobid(0), received(0), serial(0), size(0), progress(0), hedged(false)
         {
         }
         Building(uint64_t s, uint64_t id, uint32_t ser, const Job::SharedPtr& j, const std::shared_ptr<Connection> &c)
-            : started(s), jobid(id), serial(ser), job(j), conn(c)
+            : started(s), jobid(id), received(0), serial(ser), size(0), progress(s), hedged(false), job(j), conn(c)
         {
         }
 
         uint64_t started;
         uint64_t jobid;
+        // object code bytes streamed back so far
+        uint64_t received;
         uint32_t serial;
+        // preprocessed bytes sent
+        uint64_t size;
+        // when we last got something for it
+        uint64_t progress;
+        // also compiling locally
+        bool hedged;
         Job::WeakPtr job;
         std::weak_ptr<Connection> conn;
     };
+    // in ms, from what we have seen of the peer building it
+    int rescheduleTimeout(const Building& building, uint64_t now) const;
+    // how long a job that started coming back may go without progress
+    int stallTimeout(const Building& building) const;
+    // tell the peer to stop building it
+    void cancel(const Building& building);
     Map<plast::CompilerKey, List<Job::WeakPtr> > mPendingBuild;
     struct PendingPreprocess
     {
@@ -104,17 +206,67 @@ private:
     LinkedList<PendingPreprocess> mPendingPreprocess;
     Map<uint64_t, List<std::shared_ptr<Building> > > mBuildingByTime;
     Hash<uint64_t, std::shared_ptr<Building> > mBuildingById;
+    // credit we have granted and not seen used or returned yet
     Map<ConnectionKey, int> mRequested;
+    Map<ConnectionKey, uint64_t> mGrantedAt;
+    // most credit each requester gets at a time, the jobs the scheduler
+    // set aside for us when it introduced us
+    Map<ConnectionKey, int> mShares;
     Set<ConnectionKey> mHasMore;
     int mRequestedCount;
+    // moving average of how long a job for a peer takes us, in ms
+    int mCompileTime;
     int mRescheduleTimeout, mReconnectTimeout;
+    // recent send to object times, in ms
+    List<int> mDurations;
+    enum { DurationSamples = 128, MinHedgeSamples = 16, HedgePercentile = 90, MinHedgeDelay = 1000 };
+    // per peer reschedule timeouts, the configured one until we know the peer
+    enum {
+        PeerSamples = 64,
+        MinPeerSamples = 8,
+        ReschedulePercentile = 95,
+        RescheduleMargin = 2,
+        MinRescheduleTimeout = 500,
+        MinRescheduleCheck = 100,
+        MinRateSize = 4096,
+        QuietFactor = 4,
+        MinStallTimeout = 2000
+    };
     int mMaxPreprocessPending, mCurPreprocessed;
     bool mConnectionError;
+    // the load the scheduler knows about, and when it last heard from
+    // us. 0 if it hasn't since we connected
+    LoadMessage::Load mReportedLoad;
+    uint64_t mLoadReported;
+    // CompilerVersion::generation() of the compilers it knows about
+    int64_t mReportedCompilers;
+    // the counters it has, and when it got them
+    Map<String, uint64_t> mReportedStats;
+    uint64_t mStatsReported;
+    enum { LoadReportInterval = 250, LoadHeartbeat = 5000, StatsReportInterval = 5000 };
 
     struct Peer
     {
         String peer;
         uint16_t port;
+        uint32_t flags;
+        // what the peer can decode and how hard we currently try
+        uint32_t compression;
+        int compressionLevel;
+        // preprocessed chunks, our mirror of what the peer has and what we have from it
+        std::shared_ptr<ChunkStore> chunksSent, chunksReceived;
+        // hashes of pumped headers the peer has from us
+        Set<String> pumpSent;
+        // plast::WireFeature mask and interned compiler keys both ways
+        uint32_t features;
+        // moving average from granting credit to the first answer, in ms
+        int rtt;
+        // recent jobs we sent, ms from sending to the first answer and
+        // us from sending to the object per KiB of payload
+        List<int> latencies, rates;
+        uint64_t lastHeard;
+        Map<plast::CompilerKey, uint32_t> compilersSent;
+        Hash<uint32_t, plast::CompilerKey> compilersReceived;
 
         bool operator<(const Peer& other) const
         {
@@ -127,6 +279,95 @@ private:
     };
     Map<Peer, std::weak_ptr<Connection> > mPeersByKey;
     Hash<std::shared_ptr<Connection>, Peer> mPeersByConn;
+
+    // zstd gets slow quickly above the low levels, and a link that's
+    // behind at level 5 won't catch up at 19 either
+    enum { MinCompressSize = 512, CompressionBacklog = 1024 * 1024, MaxAdaptiveLevel = 5 };
+    TransferStats mTransferStats;
+
+    // payloads larger than this are streamed in chunks
+    enum { ChunkSize = 256 * 1024, ChunkStoreSize = 64 * 1024 * 1024 };
+    // bulk data not yet handed to the connection. control messages go
+    // straight to the connection and so only ever wait for one window
+    // of bulk data. objects go before payloads since they finish work
+    // and within each class jobs take turns chunk by chunk. the rest
+    // goes out when the connection has written what it had, which is
+    // at most four chunks
+    enum { SendWindow = 4 * ChunkSize };
+    struct Outgoing
+    {
+        JobDataMessage::Type type;
+        uint64_t id;
+        uint32_t serial;
+        plast::Buffer data;
+        size_t offset;
+        // sent after the last chunk, or the whole message if there is no data
+        std::function<void()> done;
+    };
+    struct OutgoingQueue
+    {
+        LinkedList<Outgoing> objects, payloads;
+    };
+    Hash<std::shared_ptr<Connection>, OutgoingQueue> mOutgoing;
+
+    // jobs smaller than MaxBatchedJob are batched until a batch holds
+    // BatchSize bytes, so the number per batch follows their size
+    enum { MaxBatchedJob = ChunkSize / 8, BatchSize = ChunkSize, MaxBatchJobs = 64 };
+    struct PendingResponses
+    {
+        PendingResponses()
+            : size(0), hasObject(false)
+        {
+        }
+
+        List<JobResponseMessage::SharedPtr> responses;
+        int size;
+        bool hasObject;
+    };
+    Hash<std::shared_ptr<Connection>, PendingResponses> mResponses;
+
+    // headers pumped to us, stored by content hash under the cache
+    // directory. the least recently used ones no job links to go when
+    // there's more than MaxPumpStoreSize
+    struct PumpEntry
+    {
+        int64_t size;
+        int users;
+        LinkedList<String>::iterator lru;
+    };
+    Hash<String, PumpEntry> mPumpStore;
+    LinkedList<String> mPumpLru;
+    int64_t mPumpStoreSize;
+    enum { MaxPumpStoreSize = 256 * 1024 * 1024 };
+
+    // remote jobs still receiving preprocessed data, by the id on the sending side
+    Hash<std::shared_ptr<Connection>, Hash<uint64_t, Job::WeakPtr> > mStreams;
+    // all remote jobs we build, the same way
+    Hash<std::shared_ptr<Connection>, Hash<uint64_t, Job::WeakPtr> > mRemoteJobs;
+    // serials of job offers we asked the payload for, by id. the job
+    // used its credit when it was offered
+    Hash<std::shared_ptr<Connection>, Hash<uint64_t, uint32_t> > mPayloadRequested;
+
+    // a hit is worth less than a remote build slot, don't hold the
+    // job for long
+    enum { ClusterFetchTimeout = 150, ClusterFetchCheck = 50 };
+    CacheRing mCacheRing;
+    struct ClusterFetch
+    {
+        uint64_t started;
+        List<Job::WeakPtr> jobs;
+    };
+    Hash<String, ClusterFetch> mClusterFetches;
+
+    // jobs waiting on an identical job that is already being built. a
+    // leader that takes longer than the timeout stops holding them up
+    enum { InFlightTimeout = 30000, InFlightCheck = 1000 };
+    struct InFlight
+    {
+        uint64_t leader, started;
+        List<Job::WeakPtr> waiters;
+    };
+    Hash<String, InFlight> mInFlight;
 };
 
 #endif
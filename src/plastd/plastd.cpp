@@ -1,4 +1,5 @@
 #include "Daemon.h"
+#include <Compression.h>
 #include <rct/EventLoop.h>
 #include <rct/Log.h>
 #include <rct/Config.h>
@@ -57,6 +58,13 @@ int main(int argc, char** argv)
     Config::registerOption<String>("cache-directory",
                                    String::format<128>("Directory to use for caches. (defaults to %s)", plast::DefaultCacheDirectory.constData()),
                                    'C', plast::DefaultCacheDirectory);
+    Config::registerOption<int>("cache-size", String::format<128>("Maximum size of the object cache in MB, 0 to disable (defaults to %d)", plast::DefaultCacheSize),
+                                'Z', plast::DefaultCacheSize,
+                                [](const int &count, String &err) { return validate<int>(count, "cache-size", err); });
+    Config::registerOption<bool>("no-direct-mode", "Don't look up cached objects before preprocessing", 'D');
+    Config::registerOption<String>("compression", "Compression for remote payloads, auto, lz4, zstd or none (defaults to auto)",
+                                   'z', String("auto"));
+    Config::registerOption<bool>("pump", "Send sources and headers to peers and let them preprocess when local slots are busy", 'u');
 
     Config::registerOption<int>("port", String::format<128>("Use this port, (default %d)", plast::DefaultDaemonPort), 'p', plast::DefaultDaemonPort,
                                 [](const int &count, String &err) { return validate<uint16_t>(count, "port", err); });
@@ -125,9 +133,28 @@ int main(int argc, char** argv)
         Config::value<int>("reschedule-check"),
         std::min(jobs, over),
         Config::value<int>("max-preprocess-pending"),
-        Path(Config::value<String>("cache-directory")).ensureTrailingSlash()
+        Path(Config::value<String>("cache-directory")).ensureTrailingSlash(),
+        static_cast<int64_t>(Config::value<int>("cache-size")) * 1024 * 1024,
+        !Config::isEnabled("no-direct-mode"),
+        plast::supportedCompression(),
+        Config::isEnabled("pump")
     };
 
+    const String compression = Config::value<String>("compression");
+    if (compression == "none") {
+        options.compression = plast::NoCompression;
+    } else if (compression == "lz4" || compression == "zstd") {
+        const plast::Compression c = (compression == "lz4" ? plast::LZ4Compression : plast::ZstdCompression);
+        if (!(options.compression & c)) {
+            fprintf(stderr, "plastd was built without %s support\n", compression.constData());
+            return 1;
+        }
+        options.compression = c;
+    } else if (compression != "auto") {
+        fprintf(stderr, "Invalid argument to -z %s\n", compression.constData());
+        return 1;
+    }
+
     // if (!Path(options.cacheDirectory + "compilers/").mkdir(Path::Recursive)) {
     //     fprintf(stderr, "Failed to mkdir --cache \"%s\"",
     //             options.cacheDirectory.constData());
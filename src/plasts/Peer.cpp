@@ -6,7 +6,7 @@ using nlohmann::json;
 int Peer::sId = 0;
 
 Peer::Peer(const SocketClient::SharedPtr& client)
-    : mId(++sId), mConnection(Connection::create(client, plast::ConnectionVersion)), mJobs(0)
+    : mId(++sId), mConnection(Connection::create(client, plast::ConnectionVersion)), mPort(0), mJobs(0), mSlots(0), mReportsLoad(false), mHasCompilers(false)
 {
     mConnection->newMessage().connect([this](const std::shared_ptr<Message>& msg, const std::shared_ptr<Connection> &conn) {
             switch (msg->messageId()) {
@@ -26,13 +26,53 @@ Peer::Peer(const SocketClient::SharedPtr& client)
             case PeerMessage::MessageId: {
                 const PeerMessage::SharedPtr peermsg = std::static_pointer_cast<PeerMessage>(msg);
                 mName = peermsg->name();
+                mPort = peermsg->port();
                 mJobs = peermsg->jobs();
+                if (!mReportsLoad)
+                    mSlots = mJobs;
                 const json obj = {
                     { "name", mName.ref() },
                     { "jobs", mJobs }
                 };
                 mEvent(shared_from_this(), PeerChanged, obj);
                 break; }
+            case LoadMessage::MessageId: {
+                const LoadMessage::SharedPtr loadmsg = std::static_pointer_cast<LoadMessage>(msg);
+                loadmsg->apply(mLoad);
+                mReportsLoad = true;
+                // reservations only end with a new count of free slots,
+                // load average and memory come and go on their own
+                const bool slots = loadmsg->fields() & LoadMessage::Slots;
+                if (slots)
+                    mSlots = mLoad.slots;
+                const json obj = {
+                    { "slots", slots }
+                };
+                mEvent(shared_from_this(), LoadChanged, obj);
+                break; }
+            case CompilersMessage::MessageId: {
+                const CompilersMessage::SharedPtr compilersmsg = std::static_pointer_cast<CompilersMessage>(msg);
+                mHasCompilers = true;
+                mCompilers = compilersmsg->compilers();
+                json compilers = json::array();
+                for (const CompilersMessage::Compiler& compiler : mCompilers) {
+                    compilers.push_back({
+                        { "type", static_cast<int>(compiler.key.type) },
+                        { "major", compiler.key.major },
+                        { "target", compiler.key.target.ref() },
+                        { "hash", compiler.hash.ref() }
+                    });
+                }
+                const json obj = {
+                    { "compilers", compilers }
+                };
+                mEvent(shared_from_this(), CompilersChanged, obj);
+                break; }
+            case StatsMessage::MessageId: {
+                const StatsMessage::SharedPtr statsmsg = std::static_pointer_cast<StatsMessage>(msg);
+                mStats = statsmsg->counters();
+                mEvent(shared_from_this(), StatsChanged, json());
+                break; }
             case BuildingMessage::MessageId: {
                 const BuildingMessage::SharedPtr bmsg = std::static_pointer_cast<BuildingMessage>(msg);
                 const json obj = {
@@ -61,3 +101,15 @@ Peer::Peer(const SocketClient::SharedPtr& client)
 Peer::~Peer()
 {
 }
+
+uint32_t Peer::capacity() const
+{
+    if (!mReportsLoad)
+        return mSlots;
+    if (mLoad.memory >= MaxMemoryUsed)
+        return 0;
+    // load we didn't put there is someone else's
+    const uint32_t load = (mLoad.loadAverage + 50) / 100;
+    const uint32_t outside = load > mLoad.running ? load - mLoad.running : 0;
+    return outside < mSlots ? mSlots - outside : 0;
+}
@@ -4,7 +4,11 @@
 #include <rct/Connection.h>
 #include <rct/SocketClient.h>
 #include <rct/SignalSlot.h>
+#include <Messages.h>
+#include <rct/List.h>
+#include <rct/Map.h>
 #include <json.hpp>
+#include <algorithm>
 #include <memory>
 
 class Peer : public std::enable_shared_from_this<Peer>
@@ -20,14 +24,38 @@ public:
 
     String ip() const { return mConnection->client()->peerName(); }
     String name() const { return mName; }
+    uint16_t port() const { return mPort; }
     uint32_t jobs() const { return mJobs; }
     int id() const { return mId; }
 
+    // free compile slots as last reported, daemons that don't report
+    // them are assumed to have all their jobs free
+    uint32_t slots() const { return mSlots; }
+    bool reportsLoad() const { return mReportsLoad; }
+    const LoadMessage::Load& load() const { return mLoad; }
+    // the slots it can really use, fewer when its own users keep it
+    // busy and none when it's short on memory
+    uint32_t capacity() const;
+
+    // the daemon's counters by name, as last reported
+    const Map<String, uint64_t>& stats() const { return mStats; }
+
+    // what the peer can build with, all of them until it tells us
+    const List<CompilersMessage::Compiler>& compilers() const { return mCompilers; }
+    bool hasCompilers() const { return mHasCompilers; }
+
+    // promised to a requester until the next report of its slots
+    // comes in, the others would never get them back
+    void reserve(uint32_t count) { if (mReportsLoad) mSlots -= std::min(count, mSlots); }
+
     enum Event {
         Websocket,
         PeerChanged,
         Disconnected,
-        JobsAvailable
+        JobsAvailable,
+        LoadChanged,
+        CompilersChanged,
+        StatsChanged
     };
     Signal<std::function<void(const Peer::SharedPtr&, Event, const nlohmann::json&)> >& event() { return mEvent; }
 
@@ -35,7 +63,13 @@ private:
     int mId;
     std::shared_ptr<Connection> mConnection;
     String mName;
-    uint32_t mJobs;
+    uint16_t mPort;
+    uint32_t mJobs, mSlots;
+    bool mReportsLoad, mHasCompilers;
+    LoadMessage::Load mLoad;
+    enum { MaxMemoryUsed = 90 };
+    List<CompilersMessage::Compiler> mCompilers;
+    Map<String, uint64_t> mStats;
     Signal<std::function<void(const Peer::SharedPtr&, Event, const nlohmann::json&)> > mEvent;
 
     static int sId;
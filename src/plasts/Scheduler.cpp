@@ -2,6 +2,8 @@
 #include <json.hpp>
 #include <JsonUtils.h>
 #include <rct/Log.h>
+#include <rct/Rct.h>
+#include <algorithm>
 #include <string.h>
 #include <regex>
 
@@ -183,6 +185,36 @@ void Scheduler::sendToAll(const String& msg)
     sendToAll(wmsg);
 }
 
+static inline json loadObject(const Peer::SharedPtr& peer)
+{
+    const LoadMessage::Load& load = peer->load();
+    const json loadj = {
+        { "type", "load" },
+        { "id", peer->id() },
+        { "slots", load.slots },
+        { "running", load.running },
+        { "pending", load.pending },
+        { "remote", load.remote },
+        { "load", load.loadAverage / 100.0 },
+        { "memory", load.memory }
+    };
+    return loadj;
+}
+
+static inline json statsObject(const Peer::SharedPtr& peer)
+{
+    json counters = json::object();
+    for (const auto& counter : peer->stats()) {
+        counters[counter.first.ref()] = counter.second;
+    }
+    const json statsj = {
+        { "type", "stats" },
+        { "id", peer->id() },
+        { "counters", counters }
+    };
+    return statsj;
+}
+
 void Scheduler::sendAllPeers(const WebSocket::SharedPtr& socket)
 {
     for (const Peer::SharedPtr& peer : mPeers) {
@@ -194,6 +226,10 @@ void Scheduler::sendAllPeers(const WebSocket::SharedPtr& socket)
         };
         const WebSocket::Message msg(WebSocket::Message::TextFrame, peerj.dump());
         socket->write(msg);
+        if (peer->reportsLoad())
+            socket->write(WebSocket::Message(WebSocket::Message::TextFrame, loadObject(peer).dump()));
+        if (!peer->stats().isEmpty())
+            socket->write(WebSocket::Message(WebSocket::Message::TextFrame, statsObject(peer).dump()));
     }
 }
 
@@ -203,17 +239,56 @@ void Scheduler::addPeer(const Peer::SharedPtr& peer)
     peer->event().connect([this](const Peer::SharedPtr& peer, Peer::Event event, const json& value) {
             switch (event) {
             case Peer::JobsAvailable: {
-                HasJobsMessage msg(static_cast<plast::CompilerType>(value["type"].get<int>()),
-                                   value["major"].get<int>(),
-                                   value["target"].get<json::string_t>(),
-                                   value["count"].get<int>(),
-                                   value["port"].get<uint16_t>());
-                msg.setPeer(value["peer"].get<std::string>());
-                for (const Peer::SharedPtr& other : mPeers) {
-                    if (other != peer) {
-                        other->connection()->send(msg);
+                const plast::CompilerKey key = {
+                    static_cast<plast::CompilerType>(value["type"].get<int>()),
+                    value["major"].get<int>(),
+                    value["target"].get<json::string_t>()
+                };
+                Demand& demand = mDemand[peer][key];
+                demand.count = value["count"].get<int>();
+                demand.port = value["port"].get<uint16_t>();
+                demand.at = Rct::monoMs();
+                match(peer, key);
+                break; }
+            case Peer::CompilersChanged: {
+                for (auto& compiler : mPeersByCompiler) {
+                    compiler.second.remove(peer);
+                }
+                for (const CompilersMessage::Compiler& compiler : peer->compilers()) {
+                    mPeersByCompiler[compiler.key].insert(peer);
+                }
+                error() << peer->name() << "has" << peer->compilers().size() << "compilers";
+                break; }
+            case Peer::StatsChanged:
+                sendToAll(statsObject(peer).dump());
+                break;
+            case Peer::LoadChanged: {
+                sendToAll(loadObject(peer).dump());
+                // the worker's requests are in its report now, if it
+                // reported its slots
+                if (value["slots"].get<bool>())
+                    mIntroduced.erase(peer);
+                if (!peer->capacity())
+                    break;
+                // see if anyone still waiting can use it
+                const uint64_t now = Rct::monoMs();
+                List<std::pair<Peer::SharedPtr, plast::CompilerKey> > waiting;
+                for (auto& requester : mDemand) {
+                    auto it = requester.second.begin();
+                    while (it != requester.second.end()) {
+                        if (now - it->second.at >= DemandTimeout) {
+                            requester.second.erase(it++);
+                        } else {
+                            waiting.append(std::make_pair(requester.first, it->first));
+                            ++it;
+                        }
                     }
                 }
+                for (const auto& w : waiting) {
+                    if (!peer->capacity())
+                        break;
+                    match(w.first, w.second);
+                }
                 break; }
             case Peer::PeerChanged: {
                 const json peerj = {
@@ -224,6 +299,7 @@ void Scheduler::addPeer(const Peer::SharedPtr& peer)
                 };
                 const WebSocket::Message msg(WebSocket::Message::TextFrame, peerj.dump());
                 sendToAll(msg);
+                sendCacheRing();
                 break; }
             case Peer::Disconnected: {
                 const json peerj = {
@@ -234,6 +310,8 @@ void Scheduler::addPeer(const Peer::SharedPtr& peer)
                 const WebSocket::Message msg(WebSocket::Message::TextFrame, peerj.dump());
                 sendToAll(msg);
                 mPeers.erase(peer);
+                forgetPeer(peer);
+                sendCacheRing();
                 break; }
             case Peer::Websocket: {
                 const WebSocket::Message msg(WebSocket::Message::TextFrame, value.dump());
@@ -243,6 +321,115 @@ void Scheduler::addPeer(const Peer::SharedPtr& peer)
         });
 }
 
+void Scheduler::match(const Peer::SharedPtr& requester, const plast::CompilerKey& key)
+{
+    auto demand = mDemand.find(requester);
+    if (demand == mDemand.end())
+        return;
+    auto it = demand->second.find(key);
+    if (it == demand->second.end())
+        return;
+    const Demand& d = it->second;
+
+    // jobs already promised to workers that haven't reported back yet
+    const auto introduction = std::make_pair(requester->id(), key);
+    int left = d.count;
+    List<Peer::SharedPtr> workers;
+    for (const Peer::SharedPtr& worker : findWorkers(key)) {
+        if (worker == requester || !worker->port())
+            continue;
+        auto introduced = mIntroduced.find(worker);
+        if (introduced != mIntroduced.end()) {
+            auto jobs = introduced->second.find(introduction);
+            if (jobs != introduced->second.end()) {
+                // still pulling from the requester, no need to tell it again
+                left -= jobs->second;
+                continue;
+            }
+        }
+        if (worker->capacity())
+            workers.append(worker);
+    }
+    if (left <= 0 || workers.isEmpty())
+        return;
+
+    // the ones with the most room, sharing the jobs by how much they have
+    std::sort(workers.begin(), workers.end(), [](const Peer::SharedPtr& a, const Peer::SharedPtr& b) {
+            return a->capacity() > b->capacity();
+        });
+    if (workers.size() > MaxIntroductions)
+        workers.resize(MaxIntroductions);
+    int64_t total = 0;
+    for (const Peer::SharedPtr& worker : workers) {
+        total += worker->capacity();
+    }
+    const int wanted = left;
+    for (const Peer::SharedPtr& worker : workers) {
+        if (left <= 0)
+            break;
+        const int64_t share = (static_cast<int64_t>(wanted) * worker->capacity() + total - 1) / total;
+        const int count = std::min<int64_t>(std::min<int64_t>(share, worker->capacity()), left);
+        HasJobsMessage msg(key.type, key.major, key.target, count, d.port);
+        msg.setPeer(requester->ip());
+        worker->connection()->send(msg);
+        worker->reserve(count);
+        if (worker->reportsLoad())
+            mIntroduced[worker][introduction] = count;
+        left -= count;
+        error() << "introduced" << worker->name() << "to" << requester->name() << "for" << count << "jobs";
+    }
+}
+
+void Scheduler::forgetPeer(const Peer::SharedPtr& peer)
+{
+    mDemand.erase(peer);
+    mIntroduced.erase(peer);
+    auto compiler = mPeersByCompiler.begin();
+    while (compiler != mPeersByCompiler.end()) {
+        compiler->second.remove(peer);
+        if (compiler->second.isEmpty())
+            mPeersByCompiler.erase(compiler++);
+        else
+            ++compiler;
+    }
+}
+
+List<Peer::SharedPtr> Scheduler::findWorkers(const plast::CompilerKey& key) const
+{
+    Set<Peer::SharedPtr> found;
+    // same type and major, sorted together
+    const plast::CompilerKey first = { key.type, key.major, String() };
+    for (auto it = mPeersByCompiler.lower_bound(first); it != mPeersByCompiler.end(); ++it) {
+        if (it->first.type != key.type || it->first.major != key.major)
+            break;
+        if (Rct::wildCmp(it->first.target.constData(), key.target.constData()))
+            found.unite(it->second);
+    }
+    List<Peer::SharedPtr> ret;
+    for (const Peer::SharedPtr& peer : mPeers) {
+        // older daemons don't say, they get to check for themselves
+        if (!peer->hasCompilers() || found.contains(peer))
+            ret.append(peer);
+    }
+    return ret;
+}
+
+void Scheduler::sendCacheRing()
+{
+    // every daemon gets the same member list, plus its own index in it
+    List<Peer::SharedPtr> peers;
+    List<CacheRingMessage::Member> members;
+    for (const Peer::SharedPtr& peer : mPeers) {
+        if (!peer->port())
+            continue;
+        peers.append(peer);
+        members.append({ peer->ip(), peer->port() });
+    }
+    for (int i=0; i<peers.size(); ++i) {
+        peers.at(i)->connection()->send(CacheRingMessage(members, i));
+    }
+}
+
 void Scheduler::init()
 {
     sInstance = shared_from_this();
@@ -260,10 +447,17 @@ void Scheduler::handleWebsocket(const HttpServer::Request::SharedPtr &req)
         Map<String, CmdHandler> cmds = {
             { "peers", [this](WebSocket* ws, const List<json>& args) {
                     for (const auto& p : mPeers) {
+                        const LoadMessage::Load& load = p->load();
                         ws->write((JsonObject()
                                    << "peer" << p->name()
                                    << "ip" << p->ip()
-                                   << "jobs" << p->jobs()).dump());
+                                   << "jobs" << p->jobs()
+                                   << "running" << load.running
+                                   << "pending" << load.pending
+                                   << "remote" << load.remote
+                                   << "load" << (load.loadAverage / 100.0)
+                                   << "memory" << load.memory
+                                   << "stats" << statsObject(p)["counters"]).dump());
                     }
                 } },
             { "block", [this](WebSocket* ws, const List<json>& args) {
@@ -304,12 +498,14 @@ void Scheduler::handleWebsocket(const HttpServer::Request::SharedPtr &req)
                             for (const auto& p : peers) {
                                 if (block(p->ip())) {
                                     mPeers.erase(p);
+                                    forgetPeer(p);
                                     const json peerj = {
                                         { "type", "peer" },
                                         { "id", p->id() },
                                         { "delete", true }
                                     };
                                     sendToAll(peerj.dump());
+                                    sendCacheRing();
                                 }
                             }
                         }
@@ -8,6 +8,7 @@
 #include <rct/SocketClient.h>
 #include <rct/SocketServer.h>
 #include <rct/Hash.h>
+#include <rct/Map.h>
 #include <rct/Set.h>
 #include <rct/String.h>
 #include <memory>
@@ -88,6 +89,12 @@ private:
     };
     void loadCompilers();
     void addPeer(const Peer::SharedPtr& peer);
+    // introduce workers with free slots to a requester with pending jobs
+    void match(const Peer::SharedPtr& requester, const plast::CompilerKey& key);
+    void forgetPeer(const Peer::SharedPtr& peer);
+    // peers that can build for the key
+    List<Peer::SharedPtr> findWorkers(const plast::CompilerKey& key) const;
+    void sendCacheRing();
     void sendAllPeers(const WebSocket::SharedPtr& socket);
     void sendToAll(const WebSocket::Message& msg);
     void sendToAll(const String& msg);
@@ -109,6 +116,21 @@ private:
     Hash<WebSocket*, WebSocket::SharedPtr> mWebSockets;
     Set<String> mBlackList, mWhiteList;
 
+    struct Demand
+    {
+        int count;
+        uint16_t port;
+        uint64_t at;
+    };
+    // what each requester last said it has pending
+    Hash<Peer::SharedPtr, Map<plast::CompilerKey, Demand> > mDemand;
+    // jobs each worker was introduced to, by requester id, until the
+    // worker's next load report
+    Hash<Peer::SharedPtr, Map<std::pair<int, plast::CompilerKey>, int> > mIntroduced;
+    enum { DemandTimeout = 2 * plast::DefaultRescheduleCheck, MaxIntroductions = 8 };
+    // peers by the compilers they announced, targets may be wildcards
+    Map<plast::CompilerKey, Set<Peer::SharedPtr> > mPeersByCompiler;
+
 private:
     static WeakPtr sInstance;
 };
@@ -435,6 +435,16 @@ Pie.prototype = {
                 this._addLegend(msg.name, group);
             }
             this._recalc();
+        } else if (msg.type === "load") {
+            if (msg.id in this._peers)
+                this._setLoad(this._peers[msg.id], msg);
+        } else if (msg.type === "stats") {
+            if (msg.id in this._peers) {
+                var peer = this._peers[msg.id];
+                peer.stats = msg.counters;
+                if (peer.lastLoad)
+                    this._setLoad(peer, peer.lastLoad);
+            }
         } else if (msg.type === "build") {
             if (msg.start)
                 this._addRunning(msg.peer);
@@ -459,6 +469,25 @@ Pie.prototype = {
         this._legends.addChild(group);
         this._rearrangeLegends();
     },
+    _setLoad: function(peer, load) {
+        var name = peer.legend.children[0];
+        if (!peer.load) {
+            peer.load = new paper.PointText({point: new paper.Point(name.bounds.right + 10, name.point.y),
+                                             justification: 'left',
+                                             fontSize: 12,
+                                             fillColor: '#888'});
+            peer.legend.addChild(peer.load);
+        }
+        peer.lastLoad = load;
+        peer.load.content = load.running + "/" + peer.msg.jobs + " running, "
+            + load.pending + " pending, load " + load.load.toFixed(2) + ", mem " + load.memory + "%";
+        var stats = peer.stats;
+        if (stats && stats["transfer.sent"])
+            peer.load.content += ", sent " + Math.round(stats["transfer.sent"] / 1024) + "K as " + Math.round(stats["transfer.sentWire"] / 1024) + "K";
+        if (stats && "cache.hits" in stats)
+            peer.load.content += ", cache " + stats["cache.hits"] + " hits " + stats["cache.misses"] + " misses";
+        paper.view.draw();
+    },
     _addConfig: function() {
         var cfg = new paper.PointText({point: new paper.Point(common.width() - 50, common.height() - 10),
                                        justification: 'left',